@@ -1,31 +1,59 @@
 #include "exception/Exception.h"
 #include "lexer/Token.h"
+#include "lexer/SourceBuffer.h"
 #include "lexer/Lexer.h"
+#include "lexer/TokenStream.h"
 
 #include "parser/AstNode.h"
 #include "parser/Parser.h"
+#include "parser/ParallelParser.h"
+#include "parser/IncrementalParser.h"
+#include "parser/FlatAst.h"
+#include "parser/ProgramCache.h"
+#include "parser/ModuleCache.h"
 
 #include "interpreter/Context.h"
 #include "interpreter/Interpreter.h"
 #include "interpreter/BuiltInFunctions.h"
 
+#include "util/ThreadPool.h"
+
 #include <iostream>
 #include <memory>
-#include <fstream>
 #include <vector>
+#include <map>
 #include <chrono>
 
 // ...
 
 using namespace std::chrono;
 
+// Inputs at least this large are lexed on a producer thread while they are parsed
+const uint32_t PIPELINED_LEXING_MIN_BYTES = 1 << 20;
+
+// Inputs at least this large are split into chunks that are lexed and parsed in parallel
+const uint32_t PARALLEL_PARSING_MIN_BYTES = 4 << 20;
+
+// Print what the optimization passes did after every run, toggled with -stats
+bool showPassStatistics = false;
+
 void showWelcomeMessage();
-std::string getFileText(std::string fileName);
-void run(std::string filename, std::string input);
+std::vector<AstNode> parseSource(SourceBuffer_sPtr source, AstArena& arena);
+std::vector<AstNode> parseModule(SourceBuffer_sPtr source, AstArena& arena);
+void run(SourceBuffer_sPtr source, ModuleCache& modules, IncrementalParser* incrementalParser = nullptr, const std::string& cacheFile = "");
+void printPassStatistics(const FlatAst& program);
 
 int main()
 {
     showWelcomeMessage();
+    addPureBuiltInFunctions(Interpreter::constantGlobals());
+    callEvaluator() = &Interpreter::evaluateCall;
+
+    // Files that are run again are only parsed again where they changed
+    std::map<std::string, std::unique_ptr<IncrementalParser>> loadedFiles;
+
+    // Imported files, shared by everything run in this shell
+    ModuleCache modules(&parseModule, ThreadPool::shared());
 
     // Shell loop
     while (true) {
@@ -39,23 +67,33 @@ int main()
         else if (input == "-e") { // Exit Program
             break;
         }
+        else if (input == "-stats") { // Toggle optimization statistics
+            showPassStatistics = !showPassStatistics;
+            std::cout << "Pass statistics " << (showPassStatistics ? "on" : "off") << std::endl;
+        }
         else if (input.find("-r ") != std::string::npos) { // Read from file
             int len = (int)input.size();
             int startIndex = (int)input.find("-r ") + 3;
             if (startIndex < len) {
                 std::string filename = input.substr(startIndex, len - startIndex);
+                SourceBuffer_sPtr source;
                 try {
-                    input = getFileText(filename);
+                    source = SourceBuffer::fromFile(filename);
+                }
+                catch (Exception e) {
+                    e.show();
+                    continue;
                 }
-                catch (...) {
-                    std::cout << "File: '" << filename << "' not found.";
+                std::unique_ptr<IncrementalParser>& incrementalParser = loadedFiles[filename];
+                if (incrementalParser == nullptr) {
+                    incrementalParser.reset(new IncrementalParser(&parseSource));
                 }
-                run(filename, input);
+                run(source, modules, incrementalParser.get(), ProgramCache::pathFor(filename));
             }
             continue;
         }
         else { // Read input as text (No flags)
-            run("Console", input);
+            run(SourceBuffer_sPtr(new SourceBuffer("Console", std::move(input))), modules);
         }
     }
 	return 0;
@@ -66,36 +104,81 @@ void showWelcomeMessage() {
     std::cout << "Type '-e' or '-exit' to close the shell.\nType -help to see a list of available commands." << std::endl;
 }
 
-void run(std::string filename, std::string input) {
-    // Lexical Analysis
-    Lexer lexer(filename, input);
-    std::vector<Token> tokens; 
-    try {
-        tokens = lexer.getTokens();
+// Lexical and Syntactical Analysis
+// The parser pulls tokens from the lexer as it needs them. Large inputs are
+// lexed on a separate thread so lexing and parsing overlap, very large ones
+// are parsed in chunks on the thread pool.
+std::vector<AstNode> parseSource(SourceBuffer_sPtr source, AstArena& arena) {
+    if (source->size() >= PARALLEL_PARSING_MIN_BYTES && ThreadPool::shared().size() > 1) {
+        ParallelParser parser(source, ThreadPool::shared(), arena);
+        return parser.parse();
     }
-    catch (Exception e) {
-        e.show();
-        return;
+
+    Lexer lexer(source);
+    std::unique_ptr<TokenStream> tokens;
+    if (source->size() >= PIPELINED_LEXING_MIN_BYTES) {
+        tokens.reset(new PipelinedTokenStream(lexer));
+    }
+    else {
+        tokens.reset(new LexerTokenStream(lexer));
+    }
+
+    Parser parser(*tokens, source, arena);
+    return parser.parse();
+}
+
+// Imported modules are parsed on the thread pool, so they are never split into
+// chunks, which would wait for the pool from inside it
+std::vector<AstNode> parseModule(SourceBuffer_sPtr source, AstArena& arena) {
+    Lexer lexer(source);
+    LexerTokenStream tokens(lexer);
+    Parser parser(tokens, source, arena);
+    return parser.parse();
+}
+
+// Files are run from their compiled form in cacheFile when it is up to date,
+// which skips lexing and parsing. Otherwise they are parsed and the cache is
+// written for the next run. An empty cacheFile disables the cache.
+void run(SourceBuffer_sPtr source, ModuleCache& modules, IncrementalParser* incrementalParser, const std::string& cacheFile) {
+    // The interpreter runs over the flattened node table, the tree is only
+    // kept for re-parsing
+    FlatAst program;
+    if (cacheFile.empty() || !ProgramCache::load(cacheFile, source, program)) {
+        // Owns the AST unless the incremental parser does, freed in one go on return
+        AstArena arena;
+        std::vector<AstNode> ast;
+        try {
+            if (incrementalParser != nullptr) {
+                ast = incrementalParser->parse(source);
+            }
+            else {
+                ast = parseSource(source, arena);
+            }
+            program = FlatAst::build(ast, source);
+        }
+        catch (Exception e) {
+            e.show();
+            return;
+        }
+
+        if (!cacheFile.empty()) {
+            ProgramCache::store(cacheFile, *source, program);
+        }
     }
 
-    if ((int)tokens.size() <= 1) return;
+    if (program.list(program.program).size() == 0) return;
 
-    // Syntactical Analysis
-    Parser parser(tokens);
-    std::vector<AstNode> ast;
+    // Imports are loaded before anything runs, see ModuleCache
+    ModuleGraph imports;
     try {
-        ast = parser.parse();
+        imports = modules.load(program, source->getFileName());
     }
     catch (Exception e) {
         e.show();
         return;
     }
 
-    if ((int)ast.size() == 0) return;
-
     // Interpreting
-    // Put vector in AstWrapper to pass through as AstNode Argument
-    AstNode programStatements = AstNode(new VectorWrapperNode(ast));
 
     
     Object_sPtr truePrimitive(new Boolean(true));
@@ -117,7 +200,7 @@ void run(std::string filename, std::string input) {
         int msBefore = (int) duration_cast<milliseconds>(
             system_clock::now().time_since_epoch()
         ).count();
-        interpreter.visit(programStatements, ctx);
+        interpreter.run(program, ctx, &imports);
         int msAfter = duration_cast<milliseconds>(
             system_clock::now().time_since_epoch()
         ).count();
@@ -126,21 +209,23 @@ void run(std::string filename, std::string input) {
     catch (Exception e) {
         e.show();
     }
-}
 
-// Method to read text from file
-std::string getFileText(std::string fileName) {
-    std::string fileText, line;
-    std::ifstream MyReadFile(fileName);
-
-    while (getline(MyReadFile, line)) {
-        fileText += line + "\n";
+    // Function bodies compiled while running are included
+    if (showPassStatistics) {
+        printPassStatistics(program);
     }
+}
 
-    MyReadFile.close();
-
-    if (fileText.size() > 0) {
-        return fileText.erase(fileText.length() - 1, 1);
-    }
-    return "";
+void printPassStatistics(const FlatAst& program) {
+    const DeadCodeStats& deadCode = program.deadCode;
+    std::cout << "Dead code: " << deadCode.branches << " branches, " << deadCode.statements << " unreachable statements, "
+        << deadCode.expressions << " unused expressions removed, " << deadCode.nodesAfter << " of "
+        << deadCode.nodesBefore << " nodes kept" << std::endl;
+    const FusionStats& fusions = program.fusions;
+    std::cout << "Fused: " << fusions.increments << " increments, " << fusions.comparisons << " comparisons with a constant, "
+        << fusions.fieldUpdates << " field updates, " << fusions.prints << " prints, " << fusions.countedLoops << " counted loops"
+        << std::endl;
+    const ScalarReplacementStats& replaced = program.scalarReplacement;
+    std::cout << "Scalar replacement: " << replaced.instances << " instances and " << replaced.lists << " lists replaced by "
+        << replaced.fields << " locals" << std::endl;
 }
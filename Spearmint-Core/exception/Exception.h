@@ -2,16 +2,36 @@
 
 #include <string>
 #include <iostream>
+#include <memory>
+
+#include "lexer/SourceMap.h"
 
 class Exception {
 public:
     std::string message;
+    std::shared_ptr<SourceMap> sourceMap;
+    Span span;
 
     Exception(std::string message) {
         this->message = message;
     }
 
+    // The location is kept as a byte span and only turned into a line and column
+    // when the message is requested
+    Exception(std::string message, std::shared_ptr<SourceMap> sourceMap, Span span) {
+        this->message = message;
+        this->sourceMap = sourceMap;
+        this->span = span;
+    }
+
+    std::string getMessage() {
+        if (sourceMap == nullptr) {
+            return message;
+        }
+        return message + " " + sourceMap->toString(span);
+    }
+
     void show() {
-        std::cout << "Exception: " + this->message << std::endl;
+        std::cout << "Exception: " + getMessage() << std::endl;
     }
-};
\ No newline at end of file
+};
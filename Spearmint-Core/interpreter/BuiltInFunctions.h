@@ -109,4 +109,18 @@ void addBuiltInFunctions(SymbolTable_sPtr symbol_table) {
     for (Function_sPtr funPtr : BUILTINFUNCTIONS) {
         symbol_table->addLocal(funPtr->name, Object_sPtr(new VariableWrapper(funPtr, true)));
     }
+}
+
+// Built-in functions without side effects whose result only depends on their arguments
+std::vector<Function_sPtr> PUREBUILTINFUNCTIONS = {
+    typeFunction, stoiFunction, stofFunction, isNullFunction, lenFunction
+};
+
+// Let the optimizer know about them and add them to symbol_table, the globals
+// of code run at compile time. Has to run before anything is compiled.
+void addPureBuiltInFunctions(SymbolTable_sPtr symbol_table) {
+    for (Function_sPtr funPtr : PUREBUILTINFUNCTIONS) {
+        pureFunctions().insert(funPtr->name);
+        symbol_table->addLocal(funPtr->name, Object_sPtr(new VariableWrapper(funPtr, true)));
+    }
 }
\ No newline at end of file
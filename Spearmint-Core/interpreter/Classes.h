@@ -7,11 +7,13 @@
 #include <unordered_map>
 #include <iterator>
 
-#include "parser/AstNode.h"
+#include "parser/FlatAst.h"
 
 class Object;
 typedef std::shared_ptr<Object> Object_sPtr;
 
+class Frame;
+
 // Base Object in Spearmint
 class Object {
 private:
@@ -152,6 +154,20 @@ public:
         return false;
     }
 
+    // ValueType and text of the type annotation, see Interpreter::checkType
+    virtual void setAnnotation(int, const std::string&) {
+        illegalOperation();
+    }
+
+    virtual int getAnnotationType() {
+        illegalOperation();
+        return 0;
+    }
+
+    virtual std::string getAnnotation() {
+        return illegalOperation()->toString();
+    }
+
     virtual int getLength() {
         illegalOperation();
         return 0;
@@ -313,7 +329,7 @@ public:
     }
 };
 
-class Float : public Object {
+class Float final : public Object {
 private:
     float value;
 
@@ -434,7 +450,7 @@ public:
     }
 };
 
-class Int : public Object {
+class Int final : public Object {
 private:
     int value;
 public:
@@ -571,6 +587,8 @@ class VariableWrapper : public Object {
 private:
     Object_sPtr obj = nullptr;
     bool constant_modifier = false; // 0 - none, 1 - const
+    int annotationType = TYPE_ANY;
+    std::string annotation;
 
 public:
     VariableWrapper(Object_sPtr obj) : Object("VariableWrapper") {
@@ -597,6 +615,19 @@ public:
         return constant_modifier;
     }
 
+    void setAnnotation(int type, const std::string& annotation) {
+        this->annotationType = type;
+        this->annotation = annotation;
+    }
+
+    int getAnnotationType() {
+        return annotationType;
+    }
+
+    std::string getAnnotation() {
+        return annotation;
+    }
+
     std::string toString() {
         if (obj == nullptr) {
             return "Null VariableWrapper";
@@ -674,17 +705,34 @@ class Function : public Object {
 public:
     std::string name;
     std::vector<std::string> argNames;
-    std::vector<AstNode> statements;
+    const FlatAst* ast = nullptr; // Tree holding the body, has to outlive the function
+    uint32_t body = 0;
+    const FlatAst* definedIn = nullptr; // Tree and node of the definition, kept when the body is compiled
+    FlatNode definition = NO_NODE;
+    FlatNode lazyDefinition = NO_NODE; // Definition whose body is compiled on the first call
+    uint32_t frameSize = 0;
+    bool reusableFrame = false; // Nothing refers to the frame of a call once it returns
+    std::weak_ptr<Frame> closure; // Frame of the scope the function was defined in
     bool builtIn = false;
     Object_sPtr(*execute)(void*) = nullptr;
 
     bool bindToObject = false;
     Object_sPtr boundObject = nullptr;
 
-    Function(std::string name, std::vector<std::string> argNames, std::vector<AstNode> statements) : Object("Function") {
+    // Function for the FUNCTION_DEF node definition of ast
+    Function(std::string name, std::vector<std::string> argNames, const FlatAst* ast, FlatNode definition) : Object("Function") {
         this->name = name;
         this->argNames = argNames;
-        this->statements = statements;
+        this->ast = ast;
+        this->definedIn = ast;
+        this->definition = definition;
+        if (ast->ops[definition] != 0) {
+            this->lazyDefinition = definition;
+        }
+        else {
+            this->body = ast->c[definition];
+            this->frameSize = ast->d[definition];
+        }
     }
 
     Function(std::string name, std::vector<std::string> argNames, Object_sPtr(*execute)(void*)) : Object("Function") {
@@ -698,9 +746,24 @@ public:
         return true;
     }
 
-    bool checkNumArgs(std::vector<AstNode> other) {
+    // Make ast and body refer to the compiled body. Returns true if they
+    // changed.
+    bool compile() {
+        if (lazyDefinition == NO_NODE) {
+            return false;
+        }
+        const FlatAst& compiled = ast->compileBody(lazyDefinition);
+        this->ast = &compiled;
+        this->body = compiled.program;
+        this->frameSize = compiled.frameSize;
+        this->reusableFrame = !compiled.frameEscapes;
+        this->lazyDefinition = NO_NODE;
+        return true;
+    }
+
+    bool checkNumArgs(uint32_t passedArgs) {
         int numArgs = (int)argNames.size();
-        int numPassedArgs = (int)other.size();
+        int numPassedArgs = (int)passedArgs;
 
         if (numArgs != numPassedArgs) {
             throw Exception("Function '" + name + "' expected " + std::to_string(numArgs) + " args, but received " +
@@ -784,7 +847,11 @@ public:
         std::shared_ptr<StructureDefinition> newInstance(new StructureDefinition(name));
         for (auto entry : fields) {
 
-            newInstance->addField(entry.first, Object_sPtr(new VariableWrapper(entry.second->getObject(), entry.second->isConstant())));
+            Object_sPtr field = Object_sPtr(new VariableWrapper(entry.second->getObject(), entry.second->isConstant()));
+            if (entry.second->getAnnotationType() != TYPE_ANY) {
+                field->setAnnotation(entry.second->getAnnotationType(), entry.second->getAnnotation());
+            }
+            newInstance->addField(entry.first, field);
         }
         return (Object_sPtr) newInstance;
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <unordered_map>
 
 #include "exception/Exception.h"
@@ -17,11 +18,11 @@ public:
         this->parent = parent;
     }
 
-    bool containsLocalKey(std::string key) {
+    bool containsLocalKey(const std::string& key) {
         return symbol_table.find(key) != symbol_table.end();
     }
 
-    bool containsKeyAnywhere(std::string key) {
+    bool containsKeyAnywhere(const std::string& key) {
         SymbolTable* cur = this;
         while (cur != nullptr) {
             if (cur->symbol_table.find(key) != cur->symbol_table.end()) {
@@ -32,11 +33,11 @@ public:
         return false;
     }
 
-    void addLocal(std::string key, Object_sPtr value) {
+    void addLocal(const std::string& key, Object_sPtr value) {
         symbol_table[key] = value;
     }
 
-    void addGlobal(std::string key, Object_sPtr value) {
+    void addGlobal(const std::string& key, Object_sPtr value) {
         SymbolTable* cur = this;
         while (cur->parent != nullptr) {
             cur = cur->parent;
@@ -44,7 +45,7 @@ public:
         cur->addLocal(key, value);
     }
 
-    void update(std::string key, Object_sPtr value) {
+    void update(const std::string& key, Object_sPtr value) {
         SymbolTable* cur = this;
         while (cur != nullptr) {
             if (cur->symbol_table.find(key) != cur->symbol_table.end()) {
@@ -55,7 +56,13 @@ public:
         }
     }
 
-    Object_sPtr get(std::string key) {
+    // Entry of key in this table only, or nullptr
+    Object_sPtr findLocal(const std::string& key) {
+        auto found = symbol_table.find(key);
+        return found != symbol_table.end() ? found->second : nullptr;
+    }
+
+    Object_sPtr get(const std::string& key) {
         SymbolTable* cur = this;
         while (cur != nullptr) {
             if (cur->symbol_table.find(key) != cur->symbol_table.end()) {
@@ -67,13 +74,28 @@ public:
         return NullType::getNullType();
     }
 
-    void remove(std::string key) {
+    void remove(const std::string& key) {
         this->symbol_table.erase(key);
     }
 };
 
 typedef std::shared_ptr<SymbolTable> SymbolTable_sPtr;
 
+// Local variables of one function call, at the slots the Resolver gave them.
+// Blocks have no frame of their own, their variables live in the frame of the
+// enclosing function. A slot is null until its declaration has run.
+class Frame {
+public:
+    std::vector<Object_sPtr> slots;
+    std::shared_ptr<Frame> parent; // Frame the function was defined in
+
+    Frame(uint32_t size, std::shared_ptr<Frame> parent) : slots(size) {
+        this->parent = parent;
+    }
+};
+
+typedef std::shared_ptr<Frame> Frame_sPtr;
+
 class Context {
 public:
     std::string name;
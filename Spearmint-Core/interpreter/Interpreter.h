@@ -3,14 +3,39 @@
 #include <string>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <unordered_set>
+#include <typeinfo>
+#include <cmath>
 
 #include "exception/Exception.h"
+#include "parser/ModuleCache.h"
 #include "Classes.h"
 #include "Context.h"
 
 class Interpreter {
 private:
 	std::string fileName;
+    const FlatAst* ast = nullptr; // Code being run, changes while a function from another tree runs
+    Frame_sPtr frame; // Locals of the code being run
+    Context* globals = nullptr;
+    std::unordered_set<std::string> declaredGlobals; // Declared at the top level of the program or a module
+
+    const ModuleGraph* modules = nullptr;
+    std::unordered_set<Module*> importedModules; // Modules whose statements already ran
+
+    // Frames of finished calls of functions with Function::reusableFrame,
+    // cleared, to be used by the next such call
+    std::vector<Frame_sPtr> spareFrames;
+    static const size_t MAX_SPARE_FRAMES = 64;
+
+    // Loop iterations and calls left before running code is given up on,
+    // unlimited if negative. Only set while a call is evaluated at compile time.
+    int64_t stepsLeft = -1;
+    uint32_t callDepth = 0;
+    static const int64_t EVALUATION_STEPS = 10000;
+    static const uint32_t EVALUATION_MAX_DEPTH = 64;
+    static const size_t EVALUATION_MAX_STRING = 1024;
 
 	Object_sPtr return_value = nullptr;
 	bool should_return = false;
@@ -19,70 +44,307 @@ private:
 
     Object_sPtr Null_sPtr = NullType::getNullType();
 
+    typedef Object_sPtr(Object::* BinaryOperation)(Object_sPtr);
+
+    // Object method for every binary Operator. Codes that are not binary
+    // operators fall back to pow.
+    static const BinaryOperation* binaryOperations() {
+        static const BinaryOperation table[OP_COUNT] = {
+            &Object::pow,           // OP_NONE
+            &Object::add,           // OP_ADD
+            &Object::sub,           // OP_SUB
+            &Object::mul,           // OP_MUL
+            &Object::div,           // OP_DIV
+            &Object::pow,           // OP_POW
+            &Object::mod,           // OP_MOD
+            &Object::compare_lt,    // OP_LT
+            &Object::compare_gt,    // OP_GT
+            &Object::compare_lte,   // OP_LTE
+            &Object::compare_gte,   // OP_GTE
+            &Object::compare_ee,    // OP_EE
+            &Object::compare_ne,    // OP_NE
+            &Object::anded_by,      // OP_AND
+            &Object::ored_by,       // OP_OR
+            &Object::pow,           // OP_NOT
+            &Object::pow,           // OP_ASSIGN
+            &Object::pow            // OP_AMPERSAND
+        };
+        return table;
+    }
+
 public:
     Interpreter() {}
     Interpreter(std::string fileName) {
         this->fileName = fileName;
     }
 
-    Object_sPtr visit(AstNode node, Context& ctx) {
-        switch (node->type) {
+    // Run the top-level statements of a program. Its imports are looked up in
+    // modules, which must have been loaded for it. Global names that are not
+    // declared anywhere are reported before anything runs.
+    Object_sPtr run(const FlatAst& program, Context& ctx, const ModuleGraph* modules = nullptr) {
+        this->ast = &program;
+        this->frame.reset(new Frame(program.frameSize, nullptr));
+        this->globals = &ctx;
+        this->modules = modules;
+        this->importedModules.clear();
+
+        declaredGlobals.clear();
+        declareGlobals(program);
+        if (modules != nullptr) {
+            for (const Module_sPtr& module : modules->modules) {
+                declareGlobals(module->program);
+            }
+            for (const Module_sPtr& module : modules->modules) {
+                checkGlobals(module->program);
+            }
+        }
+        checkGlobals(program);
+
+        return visitStatements(program.program);
+    }
+
+    // Globals code evaluated at compile time can see: true, false, null and
+    // the pure built-in functions
+    static SymbolTable_sPtr& constantGlobals() {
+        static SymbolTable_sPtr symbol_table = [] {
+            SymbolTable_sPtr table(new SymbolTable());
+            table->addLocal("true", Object_sPtr(new VariableWrapper(Object_sPtr(new Boolean(true)), true)));
+            table->addLocal("false", Object_sPtr(new VariableWrapper(Object_sPtr(new Boolean(false)), true)));
+            table->addLocal("null", Object_sPtr(new VariableWrapper(NullType::getNullType(), true)));
+            return table;
+        }();
+        return symbol_table;
+    }
+
+    // CallEvaluator running the call in an interpreter of its own, with the
+    // function itself as the only other global
+    static bool evaluateCall(const FlatAst& tree, FlatNode definition, const std::vector<LiteralValue>& args, LiteralValue& result) {
+        try {
+            Context ctx("Compile Time", SymbolTable_sPtr(new SymbolTable(*constantGlobals())));
+            Interpreter interpreter;
+            interpreter.ast = &tree;
+            interpreter.globals = &ctx;
+            std::shared_ptr<Function> function = std::static_pointer_cast<Function>(interpreter.createFunction(definition));
+            ctx.symbol_table->addLocal(function->name, Object_sPtr(new VariableWrapper(function, false)));
+            function->compile();
+            interpreter.ast = function->ast;
+            interpreter.frame.reset(new Frame(function->frameSize, nullptr));
+            for (uint32_t i = 0; i < args.size(); i++) {
+                const LiteralValue& arg = args[i];
+                Object_sPtr value;
+                if (arg.kind == NODE_INT) {
+                    value.reset(new Int((int)arg.value));
+                }
+                else if (arg.kind == NODE_FLOAT) {
+                    float number;
+                    std::memcpy(&number, &arg.value, sizeof(number));
+                    value.reset(new Float(number));
+                }
+                else {
+                    value.reset(new String(arg.text));
+                }
+                interpreter.frame->slots[i] = value;
+            }
+            interpreter.stepsLeft = EVALUATION_STEPS;
+            interpreter.visitStatements(function->body);
+            if (!interpreter.should_return) {
+                return false;
+            }
+
+            Object* value = interpreter.return_value.get();
+            if (typeid(*value) == typeid(Int)) {
+                int number = value->getIntValue();
+                result.kind = NODE_INT;
+                std::memcpy(&result.value, &number, sizeof(number));
+            }
+            else if (typeid(*value) == typeid(Float)) {
+                float number = value->getFloatValue();
+                result.kind = NODE_FLOAT;
+                std::memcpy(&result.value, &number, sizeof(number));
+            }
+            else if (typeid(*value) == typeid(String) && value->toString().size() <= EVALUATION_MAX_STRING) {
+                result.kind = NODE_STRING;
+                result.text = value->toString();
+            }
+            else {
+                return false;
+            }
+            return true;
+        }
+        catch (...) {
+            return false;
+        }
+    }
+
+private:
+    // Count a loop iteration or call against the budget
+    void step() {
+        if (stepsLeft >= 0 && (stepsLeft-- == 0 || callDepth > EVALUATION_MAX_DEPTH)) {
+            throw Exception("Evaluation budget exceeded.");
+        }
+    }
+
+    void declareGlobals(const FlatAst& tree) {
+        for (FlatNode node : tree.list(tree.program)) {
+            uint8_t kind = tree.kinds[node];
+            if (kind == NODE_VAR_DECLARATION || kind == NODE_FUNCTION_DEF || kind == NODE_STRUCT_DEF) {
+                declaredGlobals.insert(tree.string(tree.a[node]));
+            }
+        }
+    }
+
+    // Report the first global name used in tree that is neither declared at
+    // a top level nor predefined
+    void checkGlobals(const FlatAst& tree) {
+        for (FlatNode node = 0; node < tree.size(); node++) {
+            uint8_t kind = tree.kinds[node];
+            if ((kind == NODE_VAR_ACCESS || kind == NODE_VAR_ASSIGN) && tree.c[node] == GLOBAL_SCOPE) {
+                const std::string& name = tree.string(tree.a[node]);
+                if (declaredGlobals.find(name) == declaredGlobals.end() && !globals->symbol_table->containsLocalKey(name)) {
+                    if (tree.source == nullptr) {
+                        throw Exception("'" + name + "' has not been declared.");
+                    }
+                    throw Exception("'" + name + "' has not been declared.", tree.source->getSourceMap(), tree.spans[node]);
+                }
+            }
+        }
+    }
+
+    // Frame hops levels up from the current one
+    Frame* frameAt(uint32_t hops, uint32_t name) {
+        Frame* f = frame.get();
+        for (uint32_t i = 0; i < hops; i++) {
+            f = f->parent.get();
+            if (f == nullptr) {
+                throw Exception("'" + ast->string(name) + "' is no longer in scope.");
+            }
+        }
+        return f;
+    }
+
+    // Bind name to value in the scope the resolver put it in
+    void declare(uint32_t slot, uint32_t name, Object_sPtr value, bool constant, FlatNode declaration = NO_NODE) {
+        if (slot != GLOBAL_SCOPE) {
+            frame->slots[slot] = value;
+            return;
+        }
+        const std::string& varName = ast->string(name);
+        if (globals->symbol_table->containsLocalKey(varName)) {
+            throw Exception("'" + varName + "' is already in scope.");
+        }
+        Object_sPtr varWrapper = Object_sPtr(new VariableWrapper(value, constant));
+        if (declaration != NO_NODE && ast->d[declaration] != TYPE_ANY) {
+            varWrapper->setAnnotation(ast->d[declaration], ast->string(ast->e[declaration]));
+        }
+        globals->symbol_table->addLocal(varName, varWrapper);
+    }
+
+    // Whether value may be stored in a variable annotated with type. Null
+    // fits every annotation but the value types.
+    static bool fitsType(Object* value, int type, const std::string& annotation) {
+        switch (type) {
+        case TYPE_ANY:
+            return true;
+        case TYPE_INT:
+            return typeid(*value) == typeid(Int);
+        case TYPE_FLOAT:
+            return typeid(*value) == typeid(Float);
+        case TYPE_STRING:
+            return typeid(*value) == typeid(String);
+        case TYPE_BOOLEAN:
+            return typeid(*value) == typeid(Boolean);
+        case TYPE_LIST:
+            return typeid(*value) == typeid(List) || typeid(*value) == typeid(NullType);
+        default: {
+            if (typeid(*value) == typeid(NullType)) {
+                return true;
+            }
+            size_t dot = annotation.rfind('.');
+            return value->getType() == (dot == std::string::npos ? annotation : annotation.substr(dot + 1));
+        }
+        }
+    }
+
+    void checkType(const Object_sPtr& value, int type, const std::string& annotation, const std::string& varName) {
+        if (!fitsType(value.get(), type, annotation)) {
+            throw Exception("'" + varName + "' is declared as " + annotation + " but is given " + value->getType() + ".");
+        }
+    }
+
+public:
+    Object_sPtr visit(FlatNode node) {
+        switch (ast->kinds[node]) {
         case NODE_VECTOR_WRAPPER:
-            return visit_VectorWrapperNode(node, ctx);
+            return visitStatements(ast->a[node]);
         case NODE_INT:
-            return visit_IntNode(node, ctx);
+            return visit_IntNode(node);
         case NODE_FLOAT:
-            return visit_FloatNode(node, ctx);
+            return visit_FloatNode(node);
         case NODE_STRING:
-            return visit_StringNode(node, ctx);
+            return visit_StringNode(node);
         case NODE_UNARY_OP:
-           return visit_UnaryOpNode(node, ctx);
+           return visit_UnaryOpNode(node);
         case NODE_BINARY_OP:
-            return visit_BinOpNode(node, ctx);
+            return visit_BinOpNode(node);
         case NODE_VAR_DECLARATION:
-            return visit_VarDeclarationNode(node, ctx);
+            return visit_VarDeclarationNode(node);
         case NODE_VAR_ASSIGN:
-            return visit_VarAssignNode(node, ctx);
+            return visit_VarAssignNode(node);
         case NODE_VAR_ACCESS:
-            return visit_VarAccessNode(node, ctx);
+            return visit_VarAccessNode(node);
         case NODE_IF:
-            return visit_IfNode(node, ctx);
+            return visit_IfNode(node);
         case NODE_FOR:
-            return visit_ForNode(node, ctx);
+            return visit_ForNode(node);
+        case NODE_COUNTED_FOR:
+            return visit_CountedForNode(node);
         case NODE_WHILE:
-            return visit_WhileNode(node, ctx);
+            return visit_WhileNode(node);
         case NODE_FUNCTION_DEF:
-            return visit_FunctionDefNode(node, ctx);
+            return visit_FunctionDefNode(node);
         case NODE_FUNCTION_CALL:
-            return visit_FunctionCallNode(node, ctx);
+            return visit_FunctionCallNode(node);
         case NODE_RETURN:
-            return visit_ReturnNode(node, ctx);
+            return visit_ReturnNode(node);
         case NODE_BREAK:
-            return visit_BreakNode(node, ctx);
+            return visit_BreakNode(node);
         case NODE_CONTINUE:
-            return visit_ContinueNode(node, ctx);
+            return visit_ContinueNode(node);
         case NODE_STRUCT_DEF:
-            return visit_StructDefNode(node, ctx);
+            return visit_StructDefNode(node);
         case NODE_CONSTRUCTOR_CALL:
-            return visit_ConstructorCallNode(node, ctx);
+            return visit_ConstructorCallNode(node);
         case NODE_ATTRIBUTE_ACCESS:
-            return visit_AttributeAccessNode(node, ctx);
+            return visit_AttributeAccessNode(node);
         case NODE_INDEX_ACCESS:
-            return visit_IndexAccessNode(node, ctx);
+            return visit_IndexAccessNode(node);
         case NODE_ATTRIBUTE_ASSIGN:
-            return visit_AttributeAssignNode(node, ctx);
+            return visit_AttributeAssignNode(node);
         case NODE_LIST:
-            return visit_ListNode(node, ctx);
+            return visit_ListNode(node);
+        case NODE_IMPORT:
+            return visit_ImportNode(node);
+        case NODE_INLINED_CALL:
+            return visit_InlinedCallNode(node);
+        case NODE_LOOP_INVARIANT:
+            return visit_LoopInvariantNode(node);
+        case NODE_INCREMENT:
+            return visit_IncrementNode(node);
+        case NODE_COMPARE_CONSTANT:
+            return visit_CompareConstantNode(node);
+        case NODE_UPDATE_FIELD:
+            return visit_UpdateFieldNode(node);
+        case NODE_PRINT:
+            return visit_PrintNode(node);
         default:
-            throw Exception("No visit_" + std::to_string(node->type) + " method defined.");
+            throw Exception("No visit_" + std::to_string(ast->kinds[node]) + " method defined.");
         }
         return Null_sPtr;
     }
 
-    Object_sPtr visit_VectorWrapperNode(AstNode node, Context& ctx) {
-        std::vector<AstNode> v = std::static_pointer_cast<VectorWrapperNode>(node)->vec;
-        for (AstNode a : v) {
-            visit(a, ctx);
+    Object_sPtr visitStatements(uint32_t statements) {
+        for (FlatNode a : ast->list(statements)) {
+            visit(a);
             if (this->should_return) {
                 return this->return_value;
             }
@@ -94,153 +356,264 @@ public:
         return Null_sPtr;
     }
 
-    Object_sPtr visit_IntNode(AstNode node, Context& ctx) {
-        std::shared_ptr<IntNode> intNode = std::static_pointer_cast<IntNode>(node);
-        return Object_sPtr(new Int(intNode->value));
+    Object_sPtr visit_IntNode(FlatNode node) {
+        return Object_sPtr(new Int(ast->intValue(node)));
     }
 
-    Object_sPtr visit_FloatNode(AstNode node, Context& ctx) {
-        std::shared_ptr<FloatNode> floatNode = std::static_pointer_cast<FloatNode>(node);
-        return Object_sPtr(new Float(floatNode->value));
+    Object_sPtr visit_FloatNode(FlatNode node) {
+        return Object_sPtr(new Float(ast->floatValue(node)));
     }
 
-    Object_sPtr visit_StringNode(AstNode node, Context& ctx) {
-        std::shared_ptr<StringNode> strNode = std::static_pointer_cast<StringNode>(node);
-        return Object_sPtr(new String(strNode->value));
+    Object_sPtr visit_StringNode(FlatNode node) {
+        return Object_sPtr(new String(ast->string(ast->a[node])));
     }
 
-    Object_sPtr visit_VarDeclarationNode(AstNode node, Context& ctx) {
-        std::shared_ptr<VarDeclarationNode> varNode = std::static_pointer_cast<VarDeclarationNode>(node);
-        if (ctx.symbol_table->containsLocalKey(varNode->varName)) {
-            throw Exception("'" + varNode->varName + "' is already in scope.");
+    Object_sPtr visit_VarDeclarationNode(FlatNode node) {
+        Object_sPtr value = visit(ast->b[node]);
+        if (ast->d[node] != TYPE_ANY) {
+            checkType(value, ast->d[node], ast->string(ast->e[node]), ast->string(ast->a[node]));
         }
-
-        Object_sPtr value = visit(varNode->exprNode, ctx);
-        Object_sPtr varWrapper = Object_sPtr(new VariableWrapper(value, varNode->isConstant));
-        ctx.symbol_table->addLocal(varNode->varName, varWrapper);
+        declare(ast->c[node], ast->a[node], value, ast->ops[node] != 0, node);
         return value;
     }
 
-    Object_sPtr visit_VarAssignNode(AstNode node, Context& ctx) {
-        std::shared_ptr<VarAssignNode> varNode = std::static_pointer_cast<VarAssignNode>(node);
-        if (!ctx.symbol_table->containsKeyAnywhere(varNode->varName)) {
-            throw Exception("'" + varNode->varName + "' has not been declared.");
-        }
+    Object_sPtr visit_VarAssignNode(FlatNode node) {
+        if (ast->c[node] == GLOBAL_SCOPE) {
+            const std::string& varName = ast->string(ast->a[node]);
+            Object_sPtr varWrapper = globals->symbol_table->findLocal(varName);
+            if (varWrapper == nullptr) {
+                throw Exception("'" + varName + "' has not been declared.");
+            }
+            if (varWrapper->isConstant()) {
+                throw Exception("Value cannot be reassigned. Variable '" + varName + "' is declared as constant.");
+            }
 
-        Object_sPtr varWrapper = ctx.symbol_table->get(varNode->varName);
-        if (varWrapper->isConstant()) {
-            throw Exception("Value cannot be reassigned. Variable '" + varNode->varName + "' is declared as constant.");
+            Object_sPtr value = visit(ast->b[node]);
+            if (varWrapper->getAnnotationType() != TYPE_ANY) {
+                checkType(value, varWrapper->getAnnotationType(), varWrapper->getAnnotation(), varName);
+            }
+            varWrapper->storeObject(value);
+            return value;
         }
 
-        Object_sPtr value = visit(varNode->exprNode, ctx);
-        varWrapper->storeObject(value);
+        Object_sPtr& slot = frameAt(ast->c[node], ast->a[node])->slots[ast->d[node]];
+        if (slot == nullptr) {
+            throw Exception("'" + ast->string(ast->a[node]) + "' has not been declared.");
+        }
+        Object_sPtr value = visit(ast->b[node]);
+        if (ast->ops[node] != TYPE_ANY) {
+            checkType(value, ast->ops[node], ast->string(ast->e[node]), ast->string(ast->a[node]));
+        }
+        slot = value;
         return value;
     }
 
-    Object_sPtr visit_VarAccessNode(AstNode node, Context& ctx) {
-        std::shared_ptr<VarAccessNode> varNode = std::static_pointer_cast<VarAccessNode>(node);
-        if (!ctx.symbol_table->containsKeyAnywhere(varNode->varName)) {
-            throw Exception("'" + varNode->varName + "' has not been declared.");
+    Object_sPtr visit_VarAccessNode(FlatNode node) {
+        if (ast->c[node] == GLOBAL_SCOPE) {
+            const std::string& varName = ast->string(ast->a[node]);
+            Object_sPtr varWrapper = globals->symbol_table->findLocal(varName);
+            if (varWrapper == nullptr) {
+                throw Exception("'" + varName + "' has not been declared.");
+            }
+            return varWrapper->getObject();
         }
 
-        Object_sPtr varWrapper = ctx.symbol_table->get(varNode->varName);
-        return varWrapper->getObject();
+        Object_sPtr& value = frameAt(ast->c[node], ast->a[node])->slots[ast->d[node]];
+        if (value == nullptr) {
+            throw Exception("'" + ast->string(ast->a[node]) + "' has not been declared.");
+        }
+        return value;
     }
 
-    Object_sPtr visit_UnaryOpNode(AstNode node, Context& ctx) {
-        std::shared_ptr<UnaryOpNode> unaryOpNode = std::static_pointer_cast<UnaryOpNode>(node);
-        Object_sPtr res = visit(unaryOpNode->exprNode, ctx);
+    Object_sPtr visit_UnaryOpNode(FlatNode node) {
+        Object_sPtr res = visit(ast->a[node]);
 
-        if (unaryOpNode->op.compare("-") == 0) {
+        // Typed negation, the same as multiplying by Int(-1)
+        if (ast->c[node] == TYPE_INT) {
+            return Object_sPtr(new Int(static_cast<Int*>(res.get())->getIntValue() * -1));
+        }
+        else if (ast->c[node] == TYPE_FLOAT) {
+            return Object_sPtr(new Float(static_cast<Float*>(res.get())->getFloatValue() * -1.0f));
+        }
+
+        if (ast->ops[node] == OP_SUB) {
             res = res->mul(Object_sPtr(new Int(-1)));
         }
-        else if (unaryOpNode->op.compare("!") == 0) {
+        else if (ast->ops[node] == OP_NOT) {
             res = res->notted();
         }
         return res;
     }
 
-    Object_sPtr visit_BinOpNode(AstNode node, Context& ctx) {
-        std::shared_ptr<BinOpNode> binOpNode = std::static_pointer_cast<BinOpNode>(node);
-
-        Object_sPtr left = visit(binOpNode->left, ctx);
-        Object_sPtr right = visit(binOpNode->right, ctx);
+    Object_sPtr visit_BinOpNode(FlatNode node) {
+        Object_sPtr left = visit(ast->a[node]);
+        Object_sPtr right = visit(ast->b[node]);
+        return binaryOperation(node, left, right);
+    }
 
-        Object_sPtr res = Null_sPtr;
-        if (binOpNode->op.compare("+") == 0) {
-            res = left->add(right);
-        }
-        else if (binOpNode->op.compare("-") == 0) {
-            res = left->sub(right);
-        }
-        else if (binOpNode->op.compare("*") == 0) {
-            res = left->mul(right);
-        }
-        else if (binOpNode->op.compare("/") == 0) {
-            res = left->div(right);
-        }
-        else if (binOpNode->op.compare("^") == 0) {
-            res = left->pow(right);
-        }
-        else if (binOpNode->op.compare("%") == 0) {
-            res = left->mod(right);
-        }
-        else if (binOpNode->op.compare("<") == 0) {
-            res = left->compare_lt(right);
-        }
-        else if (binOpNode->op.compare(">") == 0) {
-            res = left->compare_gt(right);
+    // Operation of the BINARY_OP node on operands already visited
+    Object_sPtr binaryOperation(FlatNode node, const Object_sPtr& left, const Object_sPtr& right) {
+        if (ast->c[node] != 0) {
+            return typedBinaryOperation(ast->ops[node], ast->c[node], left.get(), right.get());
         }
-        else if (binOpNode->op.compare("<=") == 0) {
-            res = left->compare_lte(right);
-        }
-        else if (binOpNode->op.compare(">=") == 0) {
-            res = left->compare_gte(right);
-        }
-        else if (binOpNode->op.compare("==") == 0) {
-            res = left->compare_ee(right);
+        return ((*left).*binaryOperations()[ast->ops[node]])(right);
+    }
+
+    // x = x + n or x = x - n, as a VAR_ASSIGN unless x holds an Int that
+    // may be replaced by another Int
+    Object_sPtr visit_IncrementNode(FlatNode node) {
+        FlatNode sum = ast->b[node];
+        int amount = ast->intValue(ast->b[sum]);
+        if (ast->c[node] == GLOBAL_SCOPE) {
+            Object_sPtr varWrapper = globals->symbol_table->findLocal(ast->string(ast->a[node]));
+            if (varWrapper == nullptr || varWrapper->isConstant() || varWrapper->getAnnotationType() > TYPE_INT) {
+                return visit_VarAssignNode(node);
+            }
+            Object_sPtr current = varWrapper->getObject();
+            if (typeid(*current) != typeid(Int)) {
+                return visit_VarAssignNode(node);
+            }
+            int value = static_cast<Int*>(current.get())->getIntValue();
+            Object_sPtr result(new Int(ast->ops[sum] == OP_ADD ? value + amount : value - amount));
+            varWrapper->storeObject(result);
+            return result;
         }
-        else if (binOpNode->op.compare("!=") == 0) {
-            res = left->compare_ne(right);
+
+        Object_sPtr& slot = frameAt(ast->c[node], ast->a[node])->slots[ast->d[node]];
+        if (slot == nullptr || typeid(*slot) != typeid(Int) || ast->ops[node] > TYPE_INT) {
+            return visit_VarAssignNode(node);
         }
-        else if (binOpNode->op.compare("&&") == 0) {
-            res = left->anded_by(right);
+        int value = static_cast<Int*>(slot.get())->getIntValue();
+        slot = Object_sPtr(new Int(ast->ops[sum] == OP_ADD ? value + amount : value - amount));
+        return slot;
+    }
+
+    // Variable compared to an Int, compared as Floats like Int does
+    Object_sPtr visit_CompareConstantNode(FlatNode node) {
+        Object_sPtr left = visit_VarAccessNode(ast->a[node]);
+        if (typeid(*left) != typeid(Int)) {
+            return binaryOperation(node, left, visit(ast->b[node]));
+        }
+        float l = (float)static_cast<Int*>(left.get())->getIntValue();
+        float r = (float)ast->intValue(ast->b[node]);
+        switch (ast->ops[node]) {
+        case OP_LT:
+            return Object_sPtr(new Boolean(l < r));
+        case OP_GT:
+            return Object_sPtr(new Boolean(l > r));
+        case OP_LTE:
+            return Object_sPtr(new Boolean(l <= r));
+        case OP_GTE:
+            return Object_sPtr(new Boolean(l >= r));
+        case OP_EE:
+            return Object_sPtr(new Boolean(l == r));
+        default:
+            return Object_sPtr(new Boolean(l != r));
         }
-        else if (binOpNode->op.compare("||") == 0) {
-            res = left->ored_by(right);
+    }
+
+    // Operand of a typed operation as Object::getFloatValue gives it
+    static float floatOperand(Object* value, uint32_t type) {
+        if (type == TYPE_INT) {
+            return (float)static_cast<Int*>(value)->getIntValue();
         }
-        else {
-            res = left->pow(right);
+        return static_cast<Float*>(value)->getFloatValue();
+    }
+
+    // Operation on operands whose types the Resolver has proven, with the
+    // results the Int and Float classes give. See Resolver::typeBinary.
+    static Object_sPtr typedBinaryOperation(int op, uint32_t operands, Object* left, Object* right) {
+        if (operands == (TYPE_INT << 8 | TYPE_INT)) {
+            int l = static_cast<Int*>(left)->getIntValue();
+            int r = static_cast<Int*>(right)->getIntValue();
+            switch (op) {
+            case OP_ADD:
+                return Object_sPtr(new Int(l + r));
+            case OP_SUB:
+                return Object_sPtr(new Int(l - r));
+            case OP_MUL:
+                return Object_sPtr(new Int(l * r));
+            case OP_DIV:
+                return Object_sPtr(new Int(l / r));
+            default:
+                break;
+            }
         }
 
-        return res;
+        float l = floatOperand(left, operands >> 8);
+        float r = floatOperand(right, operands & 0xFF);
+        switch (op) {
+        case OP_ADD:
+            return Object_sPtr(new Float(l + r));
+        case OP_SUB:
+            return Object_sPtr(new Float(l - r));
+        case OP_MUL:
+            return Object_sPtr(new Float(l * r));
+        case OP_DIV:
+            return Object_sPtr(new Float(l / r));
+        case OP_POW:
+            return Object_sPtr(new Float((float)std::pow(l, static_cast<Int*>(right)->getIntValue())));
+        case OP_MOD:
+            return Object_sPtr(new Float(std::fmod(l, r)));
+        case OP_LT:
+            return Object_sPtr(new Boolean(l < r));
+        case OP_GT:
+            return Object_sPtr(new Boolean(l > r));
+        case OP_LTE:
+            return Object_sPtr(new Boolean(l <= r));
+        case OP_GTE:
+            return Object_sPtr(new Boolean(l >= r));
+        case OP_EE:
+            return Object_sPtr(new Boolean(l == r));
+        default:
+            return Object_sPtr(new Boolean(l != r));
+        }
     }
 
-    Object_sPtr visit_IfNode(AstNode node, Context& ctx) {
-        std::shared_ptr<IfNode> ifNode = std::static_pointer_cast<IfNode>(node);
-        Context newCtx = ctx.generateNewContext("If statement in " + ctx.name);
-
-        for (int i = 0; i < (int)ifNode->caseConditions.size(); i++) {
-            Object_sPtr cond = visit(ifNode->caseConditions.at(i), ctx);
+    Object_sPtr visit_IfNode(FlatNode node) {
+        FlatList caseConditions = ast->list(ast->a[node]);
+        FlatList caseStatements = ast->list(ast->b[node]);
+        for (uint32_t i = 0; i < caseConditions.size(); i++) {
+            Object_sPtr cond = visit(caseConditions[i]);
             if (cond->is_true()) {
-                Object_sPtr res = visit(AstNode(new VectorWrapperNode(ifNode->caseStatements.at(i))), newCtx);
+                Object_sPtr res = visitStatements(caseStatements[i]);
                 return res;
             }
         }
 
-        AstNode vw = AstNode(new VectorWrapperNode(ifNode->elseCaseStatements));
-        Object_sPtr res = visit(vw, newCtx);
+        Object_sPtr res = visitStatements(ast->c[node]);
         return res;
     }
 
-    Object_sPtr visit_ForNode(AstNode node, Context& ctx) {
-        std::shared_ptr<ForNode> forNode = std::static_pointer_cast<ForNode>(node);
-        Context initCtx = ctx.generateNewContext("For loop initializer");
-        visit(forNode->initStatement, initCtx);
+    // Invariants of a loop are evaluated again every time it starts
+    void clearInvariants(FlatNode loop) {
+        if ((ast->ops[loop] & 1) != 0) {
+            for (uint32_t slot : ast->list(ast->e[loop])) {
+                frame->slots[slot] = nullptr;
+            }
+        }
+    }
+
+    Object_sPtr visit_LoopInvariantNode(FlatNode node) {
+        uint32_t slot = ast->c[node];
+        if (frame->slots[slot] == nullptr) {
+            Object_sPtr value = visit(ast->a[node]);
+            frame->slots[slot] = value;
+        }
+        return frame->slots[slot];
+    }
 
-        while (visit(forNode->condNode, initCtx)->is_true()) {
-            Context iterCtx = initCtx.generateNewContext("For loop iteration");
-            visit(AstNode(new VectorWrapperNode(forNode->statements)), iterCtx);
+    Object_sPtr visit_ForNode(FlatNode node) {
+        clearInvariants(node);
+        visit(ast->a[node]);
+        return runFor(node);
+    }
+
+    // Iterations of the FOR node from its condition on
+    Object_sPtr runFor(FlatNode node) {
+        while (visit(ast->b[node])->is_true()) {
+            step();
+            visitStatements(ast->d[node]);
             if (this->should_break) {
                 this->should_break = false;
                 break;
@@ -248,18 +621,52 @@ public:
             else if (this->should_continue) {
                 this->should_continue = false;
             }
-            visit(forNode->updateStatement, iterCtx);
+            visit(ast->c[node]);
         }
 
         return Null_sPtr;
     }
 
-    Object_sPtr visit_WhileNode(AstNode node, Context& ctx) {
-        std::shared_ptr<WhileNode> whileNode = std::static_pointer_cast<WhileNode>(node);
+    // Keeps the counter in an int. The slot of the counter only gets an Int
+    // for the body if it reads the counter, and once the loop ends. A value
+    // that is not an Int hands the loop over to runFor.
+    Object_sPtr visit_CountedForNode(FlatNode node) {
+        clearInvariants(node);
+        FlatNode init = ast->a[node], condition = ast->b[node], update = ast->c[node];
+        visit(init);
+
+        uint32_t slot = ast->c[init];
+        Object* start = frame->slots[slot].get();
+        if (typeid(*start) != typeid(Int)) {
+            return runFor(node);
+        }
+        int counter = static_cast<Int*>(start)->getIntValue();
+        FlatNode sum = ast->b[update];
+        int amount = ast->intValue(ast->b[sum]);
+        bool up = ast->ops[sum] == OP_ADD;
+        bool readsCounter = (ast->ops[node] & 2) != 0;
+        int16_t op = ast->ops[condition];
+
+        while (true) {
+            Object_sPtr bound = visit(ast->b[condition]);
+            if (typeid(*bound) != typeid(Int)) {
+                frame->slots[slot] = Object_sPtr(new Int(counter));
+                return runFor(node);
+            }
+
+            // Int compares as Float
+            float l = (float)counter;
+            float r = (float)static_cast<Int*>(bound.get())->getIntValue();
+            bool holds = op == OP_LT ? l < r : op == OP_GT ? l > r : op == OP_LTE ? l <= r : l >= r;
+            if (!holds) {
+                break;
+            }
 
-        while (visit(whileNode->condNode, ctx)->is_true()) {
-            Context iterCtx = ctx.generateNewContext("While loop iteration");
-            visit(AstNode(new VectorWrapperNode(whileNode->statements)), iterCtx);
+            step();
+            if (readsCounter) {
+                frame->slots[slot] = Object_sPtr(new Int(counter));
+            }
+            visitStatements(ast->d[node]);
             if (this->should_break) {
                 this->should_break = false;
                 break;
@@ -267,41 +674,136 @@ public:
             else if (this->should_continue) {
                 this->should_continue = false;
             }
+            counter = up ? counter + amount : counter - amount;
         }
 
+        frame->slots[slot] = Object_sPtr(new Int(counter));
         return Null_sPtr;
     }
 
-    Object_sPtr visit_FunctionDefNode(AstNode node, Context& ctx) {
-        std::shared_ptr<FunctionDefNode> funDefNode = std::static_pointer_cast<FunctionDefNode>(node);
-        if (ctx.symbol_table->containsLocalKey(funDefNode->name)) {
-            throw Exception("Cannot define function. '" + funDefNode->name + "' is already in scope.");
+    Object_sPtr visit_WhileNode(FlatNode node) {
+        clearInvariants(node);
+        while (visit(ast->a[node])->is_true()) {
+            step();
+            visitStatements(ast->b[node]);
+            if (this->should_break) {
+                this->should_break = false;
+                break;
+            }
+            else if (this->should_continue) {
+                this->should_continue = false;
+            }
         }
 
-        Object_sPtr newFunction(new Function(funDefNode->name, funDefNode->argNames, funDefNode->statements));
-        Object_sPtr varWrapper = Object_sPtr(new VariableWrapper(newFunction, false));
-        ctx.symbol_table->addLocal(funDefNode->name, varWrapper);
+        return Null_sPtr;
+    }
+
+    // Function object for a FUNCTION_DEF node, closing over the current frame
+    Object_sPtr createFunction(FlatNode node) {
+        std::vector<std::string> argNames;
+        for (uint32_t argName : ast->list(ast->b[node])) {
+            argNames.push_back(ast->string(argName));
+        }
+        std::shared_ptr<Function> function(new Function(ast->string(ast->a[node]), argNames, ast, node));
+        function->closure = frame;
+        return function;
+    }
+
+    Object_sPtr visit_FunctionDefNode(FlatNode node) {
+        Object_sPtr newFunction = createFunction(node);
+        if (ast->e[node] == GLOBAL_SCOPE && globals->symbol_table->containsLocalKey(ast->string(ast->a[node]))) {
+            throw Exception("Cannot define function. '" + ast->string(ast->a[node]) + "' is already in scope.");
+        }
+        declare(ast->e[node], ast->a[node], newFunction, false);
         return newFunction;
     }
 
-    Object_sPtr visit_FunctionCallNode(AstNode node, Context& ctx) {
-        std::shared_ptr<FunctionCallNode> funCallNode = std::static_pointer_cast<FunctionCallNode>(node);
-        std::shared_ptr<Function> functionObj = std::static_pointer_cast<Function>(visit(funCallNode->nodeToCall, ctx));
-        functionObj->isCallable();
-        functionObj->checkNumArgs(funCallNode->argNodes);
+    Object_sPtr visit_FunctionCallNode(FlatNode node) {
+        std::shared_ptr<Function> functionObj = std::static_pointer_cast<Function>(visit(ast->a[node]));
+        return call(functionObj, ast->list(ast->b[node]));
+    }
+
+    // Writes the argument itself while the callee is the built-in print or
+    // println, without setting up a call
+    Object_sPtr visit_PrintNode(FlatNode node) {
+        Object_sPtr callee = visit(ast->a[node]);
+        Function* function = dynamic_cast<Function*>(callee.get());
+        const char* name = ast->ops[node] != 0 ? "println" : "print";
+        if (function == nullptr || !function->isBuiltIn() || function->name != name) {
+            return call(std::static_pointer_cast<Function>(callee), ast->list(ast->b[node]));
+        }
 
-        Context funCtx = ctx.generateNewContext("Function '" + functionObj->name + "'");
-        for (int i = 0; i < (int)functionObj->argNames.size(); i++) {
-            Object_sPtr arg_value = visit(funCallNode->argNodes.at(i), ctx);
-            Object_sPtr varWrapper = Object_sPtr(new VariableWrapper(arg_value));
-            funCtx.symbol_table->addLocal(functionObj->argNames.at(i), varWrapper);
+        std::cout << visit(ast->list(ast->b[node])[0])->toString();
+        if (ast->ops[node] != 0) {
+            std::cout << "\n";
         }
+        return Null_sPtr;
+    }
 
+    // Runs the copy of the callee's body in the current frame, unless the
+    // callee is no longer the function the copy was made from
+    Object_sPtr visit_InlinedCallNode(FlatNode node) {
+        Object_sPtr callee = visit(ast->a[node]);
+        Function* function = dynamic_cast<Function*>(callee.get());
+        FlatList argNodes = ast->list(ast->b[node]);
+        const FlatAst* definedIn = ast->parent != nullptr ? ast->parent : ast;
+        if (function == nullptr || function->definedIn != definedIn || function->definition != ast->e[node]) {
+            return call(std::static_pointer_cast<Function>(callee), argNodes);
+        }
+
+        uint32_t slot = ast->c[node];
+        for (uint32_t i = 0; i < argNodes.size(); i++) {
+            frame->slots[slot + i] = visit(argNodes[i]);
+        }
+        visitStatements(ast->d[node]);
+
+        if (this->should_return) {
+            Object_sPtr retValue = this->return_value;
+            this->return_value = Null_sPtr;
+            this->should_return = false;
+            return retValue;
+        }
+
+        return Null_sPtr;
+    }
+
+    Object_sPtr call(std::shared_ptr<Function> functionObj, FlatList argNodes) {
+        step();
+        functionObj->isCallable();
+        functionObj->checkNumArgs(argNodes.size());
+
+        // Built-in functions read their arguments by name
         if (functionObj->isBuiltIn()) {
+            Context funCtx("Function '" + functionObj->name + "'", SymbolTable_sPtr(new SymbolTable()));
+            for (int i = 0; i < (int)functionObj->argNames.size(); i++) {
+                Object_sPtr varWrapper = Object_sPtr(new VariableWrapper(visit(argNodes[i])));
+                funCtx.symbol_table->addLocal(functionObj->argNames.at(i), varWrapper);
+            }
             return functionObj->executeWrapper(&funCtx);
         }
 
-        visit(AstNode(new VectorWrapperNode(functionObj->statements)), funCtx);
+        if (functionObj->compile()) {
+            checkGlobals(*functionObj->ast);
+        }
+
+        // The arguments are the first slots of the frame
+        Frame_sPtr callFrame = frameFor(*functionObj);
+        for (uint32_t i = 0; i < argNodes.size(); i++) {
+            callFrame->slots[i] = visit(argNodes[i]);
+        }
+
+        const FlatAst* caller = this->ast;
+        Frame_sPtr callerFrame = std::move(this->frame);
+        this->ast = functionObj->ast;
+        this->frame = std::move(callFrame);
+        callDepth++;
+        visitStatements(functionObj->body);
+        callDepth--;
+        this->ast = caller;
+        std::swap(this->frame, callerFrame);
+        if (functionObj->reusableFrame) {
+            recycle(std::move(callerFrame));
+        }
 
         if (this->should_return) {
             Object_sPtr retValue = this->return_value;
@@ -313,98 +815,155 @@ public:
         return Null_sPtr;
     }
 
-    Object_sPtr visit_ReturnNode(AstNode node, Context& ctx) {
-        std::shared_ptr<ReturnNode> returnNode = std::static_pointer_cast<ReturnNode>(node);
-        if (returnNode->exprNode != nullptr) {
-            this->return_value = visit(returnNode->exprNode, ctx);
+    Frame_sPtr frameFor(Function& function) {
+        if (!function.reusableFrame || spareFrames.empty()) {
+            return Frame_sPtr(new Frame(function.frameSize, function.closure.lock()));
+        }
+        Frame_sPtr reused = std::move(spareFrames.back());
+        spareFrames.pop_back();
+        reused->slots.resize(function.frameSize);
+        reused->parent = function.closure.lock();
+        return reused;
+    }
+
+    // Keeps the frame of a finished call for the next one. The locals are
+    // released now, as they would be if the frame was freed.
+    void recycle(Frame_sPtr finished) {
+        if (spareFrames.size() >= MAX_SPARE_FRAMES || finished.use_count() != 1) {
+            return;
+        }
+        finished->slots.clear();
+        finished->parent = nullptr;
+        spareFrames.push_back(std::move(finished));
+    }
+
+    Object_sPtr visit_ReturnNode(FlatNode node) {
+        if (ast->a[node] != NO_NODE) {
+            this->return_value = visit(ast->a[node]);
         }
         this->should_return = true;
         return Null_sPtr;
     }
 
-    Object_sPtr visit_BreakNode(AstNode node, Context& ctx) {
+    Object_sPtr visit_BreakNode(FlatNode node) {
         this->should_break = true;
         return Null_sPtr;
     }
 
-    Object_sPtr visit_ContinueNode(AstNode node, Context& ctx) {
+    Object_sPtr visit_ContinueNode(FlatNode node) {
         this->should_continue = true;
         return Null_sPtr;
     }
 
-    Object_sPtr visit_StructDefNode(AstNode node, Context& ctx) {
-        std::shared_ptr<StructureDefNode> structDefNode = std::static_pointer_cast<StructureDefNode>(node);
+    Object_sPtr visit_StructDefNode(FlatNode node) {
+        const std::string& name = ast->string(ast->a[node]);
 
-        if (ctx.symbol_table->containsKeyAnywhere(structDefNode->name)) {
-            throw Exception("Struct '" + structDefNode->name + "' is already defined.");
+        if (ast->c[node] == GLOBAL_SCOPE && globals->symbol_table->containsLocalKey(name)) {
+            throw Exception("Struct '" + name + "' is already defined.");
         }
 
-        std::shared_ptr<StructureDefinition> newClass = std::shared_ptr<StructureDefinition>(new StructureDefinition(structDefNode->name));
-        Object_sPtr varWrapper = Object_sPtr(new VariableWrapper(newClass, true));
-        ctx.symbol_table->addLocal(structDefNode->name, varWrapper);
+        std::shared_ptr<StructureDefinition> newClass = std::shared_ptr<StructureDefinition>(new StructureDefinition(name));
+        declare(ast->c[node], ast->a[node], newClass, true);
 
-        for (AstNode a : structDefNode->statements) {
-            if (a->type == NODE_VAR_DECLARATION) {
-                std::shared_ptr<VarDeclarationNode> varNode = std::static_pointer_cast<VarDeclarationNode>(a);
-                newClass->addField(varNode->varName, Object_sPtr(new VariableWrapper(visit(varNode->exprNode, ctx), false)));
+        for (FlatNode a : ast->list(ast->b[node])) {
+            if (ast->kinds[a] == NODE_VAR_DECLARATION) {
+                Object_sPtr field = Object_sPtr(new VariableWrapper(visit(ast->b[a]), false));
+                if (ast->d[a] != TYPE_ANY) {
+                    checkType(field->getObject(), ast->d[a], ast->string(ast->e[a]), ast->string(ast->a[a]));
+                    field->setAnnotation(ast->d[a], ast->string(ast->e[a]));
+                }
+                newClass->addField(ast->string(ast->a[a]), field);
             }
-            else if (a->type == NODE_FUNCTION_DEF) {
-                std::shared_ptr<FunctionDefNode> funDefNode = std::static_pointer_cast<FunctionDefNode>(a);
-                Object_sPtr newFunction(new Function(funDefNode->name, funDefNode->argNames, funDefNode->statements));
-                newClass->addField(funDefNode->name, Object_sPtr(new VariableWrapper(newFunction, false)));
+            else if (ast->kinds[a] == NODE_FUNCTION_DEF) {
+                Object_sPtr newFunction = createFunction(a);
+                newClass->addField(ast->string(ast->a[a]), Object_sPtr(new VariableWrapper(newFunction, false)));
             }
             else {
-                throw Exception(a->type + " cannot be used in a structure definition.");
+                throw Exception(std::to_string(ast->kinds[a]) + " cannot be used in a structure definition.");
             }
         }
 
         return newClass;
     }
 
-    Object_sPtr visit_ConstructorCallNode(AstNode node, Context& ctx) {
-        std::shared_ptr<ConstructorCallNode> constructorCallNode = std::static_pointer_cast<ConstructorCallNode>(node);
-        Object_sPtr structureDef = visit(constructorCallNode->structureNode, ctx);
+    Object_sPtr visit_ConstructorCallNode(FlatNode node) {
+        Object_sPtr structureDef = visit(ast->a[node]);
         return structureDef->createInstance();
     }
 
-    Object_sPtr visit_AttributeAccessNode(AstNode node, Context& ctx) {
-        std::shared_ptr<AttributeAccessNode> attrAccessNode = std::static_pointer_cast<AttributeAccessNode>(node);
-        Object_sPtr structure = visit(attrAccessNode->exprNode, ctx);
+    Object_sPtr visit_AttributeAccessNode(FlatNode node) {
+        Object_sPtr structure = visit(ast->a[node]);
 
-        Object_sPtr varWrapper = structure->getField(attrAccessNode->name);
-        Object_sPtr obj = varWrapper->getObject();
+        Object_sPtr varWrapper = structure->getField(ast->string(ast->b[node]));
         return varWrapper->getObject();
     }
 
-    Object_sPtr visit_IndexAccessNode(AstNode node, Context& ctx) {
-        std::shared_ptr<IndexAccessNode> indexAccessNode = std::static_pointer_cast<IndexAccessNode>(node);
-        Object_sPtr list = visit(indexAccessNode->node, ctx);
-        Object_sPtr index = visit(indexAccessNode->indexNode, ctx);
+    Object_sPtr visit_IndexAccessNode(FlatNode node) {
+        Object_sPtr list = visit(ast->a[node]);
+        Object_sPtr index = visit(ast->b[node]);
         
         return list->getIndex(index);
     }
 
-    Object_sPtr visit_AttributeAssignNode(AstNode node, Context& ctx) {
-        std::shared_ptr<AttributeAssignNode> attrAssignNode = std::static_pointer_cast<AttributeAssignNode>(node);
-        std::shared_ptr<AttributeAccessNode> attrAccessNode = std::static_pointer_cast<AttributeAccessNode>(attrAssignNode->attrNode);
+    Object_sPtr visit_AttributeAssignNode(FlatNode node) {
+        FlatNode attrAccessNode = ast->a[node];
         
-        Object_sPtr obj = visit(attrAccessNode->exprNode, ctx);
+        Object_sPtr obj = visit(ast->a[attrAccessNode]);
 
-        Object_sPtr varWrapper = obj->getField(attrAccessNode->name);
-        Object_sPtr value = visit(attrAssignNode->exprNode, ctx);
+        Object_sPtr varWrapper = obj->getField(ast->string(ast->b[attrAccessNode]));
+        Object_sPtr value = visit(ast->b[node]);
+        if (varWrapper->getAnnotationType() != TYPE_ANY) {
+            checkType(value, varWrapper->getAnnotationType(), varWrapper->getAnnotation(), ast->string(ast->b[attrAccessNode]));
+        }
         varWrapper->storeObject(value);
 
         return value;
     }
 
-    Object_sPtr visit_ListNode(AstNode node, Context& ctx) {
-        std::shared_ptr<ListNode> listNode = std::static_pointer_cast<ListNode>(node);
+    // v.f = v.f op value, reading v and looking up f once
+    Object_sPtr visit_UpdateFieldNode(FlatNode node) {
+        FlatNode attrAccessNode = ast->a[node];
+        FlatNode operation = ast->b[node];
+
+        Object_sPtr obj = visit(ast->a[attrAccessNode]);
+        Object_sPtr varWrapper = obj->getField(ast->string(ast->b[attrAccessNode]));
+        Object_sPtr value = binaryOperation(operation, varWrapper->getObject(), visit(ast->b[operation]));
+        if (varWrapper->getAnnotationType() != TYPE_ANY) {
+            checkType(value, varWrapper->getAnnotationType(), varWrapper->getAnnotation(), ast->string(ast->b[attrAccessNode]));
+        }
+        varWrapper->storeObject(value);
+
+        return value;
+    }
+
+    Object_sPtr visit_ListNode(FlatNode node) {
         Object_sPtr listObj = Object_sPtr(new List());
 
-        for (AstNode n : listNode->listValueNodes) {
-            listObj->add(visit(n, ctx));
+        for (FlatNode n : ast->list(ast->a[node])) {
+            listObj->add(visit(n));
         }
 
         return listObj;
     }
-};
\ No newline at end of file
+
+    // Runs the statements of the imported module in a frame of its own, the
+    // first time it is imported. Its top-level declarations are globals.
+    Object_sPtr visit_ImportNode(FlatNode node) {
+        Module* module = nullptr;
+        if (modules == nullptr || !modules->target(ast, node, module)) {
+            throw Exception("Module '" + ast->string(ast->a[node]) + "' was not loaded.");
+        }
+        if (module == nullptr || !importedModules.insert(module).second) {
+            return Null_sPtr;
+        }
+
+        const FlatAst* importer = this->ast;
+        Frame_sPtr importerFrame = std::move(this->frame);
+        this->ast = &module->program;
+        this->frame.reset(new Frame(module->program.frameSize, nullptr));
+        visitStatements(module->program.program);
+        this->ast = importer;
+        this->frame = std::move(importerFrame);
+        return Null_sPtr;
+    }
+};
@@ -1,192 +1,300 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_set>
-#include <unordered_map>
+#include <cstddef>
 
 #include "Token.h"
+#include "SourceBuffer.h"
+#include "Scanner.h"
 #include "exception/Exception.h"
 
+// Keywords are recognized with a perfect hash over (first char, last char, length).
+// The table is built at compile time and the static_assert rejects any keyword
+// list that does not hash without collisions.
+namespace keywords {
+    struct Entry {
+        std::string_view text;
+        int keyword = KW_NONE;
+    };
+
+    constexpr Entry LIST[] = {
+        { "import", KW_IMPORT }, { "const", KW_CONST }, { "var", KW_VAR },
+        { "if", KW_IF }, { "else", KW_ELSE }, { "for", KW_FOR }, { "while", KW_WHILE },
+        { "break", KW_BREAK }, { "continue", KW_CONTINUE },
+        { "fn", KW_FN }, { "return", KW_RETURN }, { "type", KW_TYPE }, { "new", KW_NEW }, { "api", KW_API }
+    };
+
+    constexpr size_t TABLE_SIZE = 32;
+
+    constexpr size_t hash(std::string_view text) {
+        return ((unsigned char)text.front() + (unsigned char)text.back() + text.size()) & (TABLE_SIZE - 1);
+    }
+
+    constexpr bool isPerfect() {
+        for (const Entry& a : LIST) {
+            for (const Entry& b : LIST) {
+                if (a.keyword != b.keyword && hash(a.text) == hash(b.text)) return false;
+            }
+        }
+        return true;
+    }
+    static_assert(isPerfect(), "Keyword hash has collisions");
+
+    struct Table {
+        Entry slots[TABLE_SIZE] = {};
+
+        constexpr Table() {
+            for (const Entry& e : LIST) {
+                slots[hash(e.text)] = e;
+            }
+        }
+    };
+
+    constexpr Table TABLE = Table();
+
+    // Returns KW_NONE if the identifier is not a keyword
+    inline int lookup(std::string_view text) {
+        const Entry& entry = TABLE.slots[hash(text)];
+        return entry.text == text ? entry.keyword : KW_NONE;
+    }
+}
+
 
 class Lexer {
 private:
-    std::string fn;
-    std::string text;
-    int index;
+    SourceBuffer_sPtr source;
+    const char* text;
+    uint32_t length;
+    uint32_t index;
     char curChar;
-    Position curPos;
 
 public:
-    Lexer(std::string fn, std::string text) {
-        this->fn = fn;
-        this->text = text;
-        this->index = -1;
-        this->curPos = Position(fn);
-        getNext();
+    Lexer(SourceBuffer_sPtr source) {
+        this->source = source;
+        this->text = source->data();
+        this->length = source->size();
+        this->index = 0;
+        this->curChar = length > 0 ? text[0] : '\0';
+    }
+
+    // Lex only [begin, end) of the source. Tokens keep their offsets in the
+    // whole file and END is reported at end.
+    Lexer(SourceBuffer_sPtr source, uint32_t begin, uint32_t end) {
+        this->source = source;
+        this->text = source->data();
+        this->length = end;
+        this->index = begin;
+        this->curChar = begin < end ? text[begin] : '\0';
+    }
+
+    SourceBuffer_sPtr getSource() {
+        return source;
     }
 
 private:
-    bool hasNext(int stepsAhead=1) {
-        return this->index + stepsAhead < (int)text.length();
+    bool hasNext(uint32_t stepsAhead=1) {
+        return this->index + stepsAhead < length;
     }
 
     void getNext() {
         if (hasNext()) {
             index++;
-            this->curPos.advance(curChar);
-            this->curChar = this->text.at(index);
+            this->curChar = this->text[index];
         }
         else {
+            index = length;
             this->curChar = '\0';
         }
     }
 
-    char lookAhead(int stepsAhead) {
-        return hasNext(stepsAhead) ? this->text.at(this->index + stepsAhead) : '\0';
+    // Jump forward to an index found by one of the scanning kernels
+    void moveTo(uint32_t newIndex) {
+        index = newIndex;
+        this->curChar = index < length ? this->text[index] : '\0';
+    }
+
+    uint32_t scan(scanner::ScanFunction kernel, uint32_t from) {
+        return (uint32_t)(kernel(text + from, text + length) - text);
+    }
+
+    char lookAhead(uint32_t stepsAhead) {
+        return hasNext(stepsAhead) ? this->text[this->index + stepsAhead] : '\0';
+    }
+
+    std::string_view view(uint32_t start, uint32_t end) {
+        return std::string_view(text + start, end - start);
+    }
+
+    Exception error(std::string message, uint32_t offset) {
+        return Exception(message, source->getSourceMap(), Span(offset, 1));
     }
 
 public:
+    // Lex the whole input at once
     std::vector<Token> getTokens() {
         std::vector<Token> tokens;
-        std::string operators = "+-*/^%=<>!&";
-        std::unordered_set<std::string> keywords = { 
-            "import", "const", "var",
-            "if", "else", "for", "while", "break", "continue",
-            "fn", "return", "type", "new", "api"
-        };
+        do {
+            tokens.push_back(next());
+        } while (!tokens.back().matches(END));
+        return tokens;
+    }
 
-        while (curChar != '\0') {
-            std::string next2chars = std::string(1, curChar) + lookAhead(1);
+    // Pull the next token from the input. Once the input is exhausted every call returns END.
+    Token next() {
+        const scanner::Kernels& kernels = scanner::kernels();
+        const CharTable& table = charTable();
 
-            if (curChar == ' ' || curChar == '\t' || curChar == '\n') { // Skip whitespace
-            }
-            else if (curChar == '#') { // Skip Comments
-                while (curChar != '\n' && curChar != '\0') {
-                    getNext();
-                }
-            }
-            else if (isalpha(curChar) || curChar == '_') { // Keywords and Identifiers
-                Position startPos = curPos.copy();
-                std::string str = "";
-
-                while (isalpha(curChar) || isdigit(curChar) || curChar == '_') {
-                    str += curChar;
-                    getNext();
-                }
-
-                if (keywords.find(str) != keywords.end()) {
-                    tokens.push_back(Token(KEYWORD, str, startPos));
-                }
-                else {
-                    tokens.push_back(Token(ID, str, startPos));
-                }
-                continue;
-            }
-            else if (isdigit(curChar)) { // Numbers
-                Position startPos = curPos.copy();
-                std::string number = "";
-
-                int decimal_count = 0;
-                while (isdigit(curChar) || curChar == '.') {
-                    if (curChar == '.') {
-                        if (decimal_count == 1) break;
-                        decimal_count++;
-                    }
-                    number += curChar;
-                    getNext();
-                }
-
-                if (decimal_count == 0) {
-                    tokens.push_back(Token(INT, number));
-                }
-                else {
-                    tokens.push_back(Token(FLOAT, number));
-                }
-
-                continue;
-            }
-            else if (curChar == '"') { // Strings
-                Position startPos = curPos.copy();
-                getNext();
-                std::unordered_map<char, std::string> escapeChars = {
-                    {'"', "\""},
-                    {'n', "\n"},
-                    {'t', "\t"},
-                    {'\\', "\\"}
-                };
-
-                std::string str;
-                while (curChar != '"') {
-                    if (curChar == '\0') {
-                        throw Exception("Unterminated string " + startPos.toString());
-                    }
-
-                    if (curChar == '\\') {
-                        if (escapeChars.find(lookAhead(1)) == escapeChars.end()) {
-                            throw Exception("Unescaped slash in string " + curPos.toString());
-                        }
-
-                        str += escapeChars.at(lookAhead(1));
-                        getNext();
-                        getNext();
-                    }
-                    else {
-                        str += curChar;
-                        getNext();
-                    }
-                }
-                tokens.push_back(Token(STRING, str, startPos));
-            }
-            else if (next2chars == "!=" || next2chars == "==" || next2chars == "<=" || next2chars == ">=" ||
-                next2chars == "&&" || next2chars == "||") { // 2 character operators
-                tokens.push_back(Token(OP, next2chars, curPos));
-                getNext();
-            }
-            else if (next2chars == "->") { // Right Arrow
-                tokens.push_back(Token(RARROW, "->"));
-                getNext();
-            }
-            else if (operators.find(curChar) != std::string::npos) { // 1 character operators
-                tokens.push_back(Token(OP, curChar, curPos));
-            }
-            else if (curChar == '.') { // Dot
-                tokens.push_back(Token(DOT, curChar, curPos));
-            }
-            else if (curChar == ',') { // Comma
-                tokens.push_back(Token(COMMA, curChar, curPos));
-            }
-            else if (curChar == ':') { // Colon
-                tokens.push_back(Token(COLON, curChar, curPos));
-            }
-            else if (curChar == ';') { // Semicolons
-                tokens.push_back(Token(SEMICOLON, curChar, curPos));
+        while (true) {
+            moveTo(scan(kernels.whitespace, index)); // Skip whitespace
+            if (curChar != '#') break;
+            moveTo(scan(kernels.line, index)); // Skip Comments
+        }
+
+        if (curChar == '\0') {
+            return Token(END, "END", length);
+        }
+
+        uint32_t start = index;
+        if (table.is(curChar, CHAR_ALPHA)) { // Keywords and Identifiers
+            moveTo(scan(kernels.identifier, index));
+
+            std::string_view str = view(start, index);
+            int keyword = keywords::lookup(str);
+            if (keyword != KW_NONE) {
+                return Token(KEYWORD, str, start, keyword);
             }
-            else if (curChar == '(') { // Left Parenthesis
-                tokens.push_back(Token(LPAREN, curChar, curPos));
+            return Token(ID, str, start);
+        }
+        else if (table.is(curChar, CHAR_DIGIT)) { // Numbers
+            // Digits with at most one decimal point
+            moveTo(scan(kernels.digits, index));
+            if (curChar != '.') {
+                return Token(INT, view(start, index), start);
             }
-            else if (curChar == ')') { // Right Parenthesis
-                tokens.push_back(Token(RPAREN, curChar, curPos));
+            moveTo(scan(kernels.digits, index + 1));
+            return Token(FLOAT, view(start, index), start);
+        }
+        else if (curChar == '"') { // Strings
+            return string();
+        }
+
+        int type;
+        int code = 0;
+        uint32_t tokenLength = 1;
+        if ((code = twoCharOperator(curChar, lookAhead(1))) != OP_NONE) { // 2 character operators
+            type = OP;
+            tokenLength = 2;
+        }
+        else if (curChar == '-' && lookAhead(1) == '>') { // Right Arrow
+            type = RARROW;
+            tokenLength = 2;
+        }
+        else if (table.is(curChar, CHAR_OPERATOR)) { // 1 character operators
+            type = OP;
+            code = oneCharOperator(curChar);
+        }
+        else {
+            switch (curChar) {
+            case '.': type = DOT; break;
+            case ',': type = COMMA; break;
+            case ':': type = COLON; break;
+            case ';': type = SEMICOLON; break;
+            case '(': type = LPAREN; break;
+            case ')': type = RPAREN; break;
+            case '{': type = LBRACE; break;
+            case '}': type = RBRACE; break;
+            case '[': type = LBRACKET; break;
+            case ']': type = RBRACKET; break;
+            default: // Invalid Character Exception
+                throw error("Invalid character: '" + std::string(1, curChar) + "'", index);
             }
-            else if (curChar == '{') { // Left Brace
-                tokens.push_back(Token(LBRACE, curChar, curPos));
+        }
+
+        moveTo(start + tokenLength);
+        return Token(type, view(start, start + tokenLength), start, code);
+    }
+
+private:
+    Token string() {
+        const scanner::Kernels& kernels = scanner::kernels();
+        uint32_t start = index;
+        getNext();
+
+        // Strings without escape sequences are a view of the source text. Only
+        // literals that contain escapes need a buffer of their own.
+        uint32_t bodyStart = index;
+        bool hasEscapes = false;
+        std::string str;
+        while (true) {
+            uint32_t runEnd = scan(kernels.stringBody, index);
+            if (hasEscapes) {
+                str.append(text + index, runEnd - index);
             }
-            else if (curChar == '}') { // Right Brace
-                tokens.push_back(Token(RBRACE, curChar, curPos));
+            moveTo(runEnd);
+
+            if (curChar == '"') {
+                break;
             }
-            else if (curChar == '[') { // Left Bracket
-                tokens.push_back(Token(LBRACKET, curChar, curPos));
+            else if (curChar == '\0') {
+                throw error("Unterminated string", start);
             }
-            else if (curChar == ']') { // Right Bracket
-                tokens.push_back(Token(RBRACKET, curChar, curPos));
+
+            // Escape sequence
+            char escaped;
+            switch (lookAhead(1)) {
+            case '"': escaped = '"'; break;
+            case 'n': escaped = '\n'; break;
+            case 't': escaped = '\t'; break;
+            case '\\': escaped = '\\'; break;
+            default:
+                throw error("Unescaped slash in string", index);
             }
-            else { // Invalid Character Exception 
-                throw Exception("Invalid character: '" + std::string(1, curChar) + "' " + curPos.toString());
+
+            if (!hasEscapes) {
+                str.assign(text + bodyStart, index - bodyStart);
+                hasEscapes = true;
             }
-            getNext();
+            str += escaped;
+            moveTo(index + 2);
         }
+        uint32_t bodyEnd = index;
+        getNext(); // Closing quote
 
-        tokens.push_back(Token(END, "END"));
-        return tokens;
+        if (hasEscapes) {
+            return Token(STRING, source->store(std::move(str)), start);
+        }
+        return Token(STRING, view(bodyStart, bodyEnd), start);
+    }
+
+private:
+    static int twoCharOperator(char first, char second) {
+        switch (first) {
+        case '!': return second == '=' ? OP_NE : OP_NONE;
+        case '=': return second == '=' ? OP_EE : OP_NONE;
+        case '<': return second == '=' ? OP_LTE : OP_NONE;
+        case '>': return second == '=' ? OP_GTE : OP_NONE;
+        case '&': return second == '&' ? OP_AND : OP_NONE;
+        case '|': return second == '|' ? OP_OR : OP_NONE;
+        default: return OP_NONE;
+        }
+    }
+
+    static int oneCharOperator(char c) {
+        switch (c) {
+        case '+': return OP_ADD;
+        case '-': return OP_SUB;
+        case '*': return OP_MUL;
+        case '/': return OP_DIV;
+        case '^': return OP_POW;
+        case '%': return OP_MOD;
+        case '=': return OP_ASSIGN;
+        case '<': return OP_LT;
+        case '>': return OP_GT;
+        case '!': return OP_NOT;
+        case '&': return OP_AMPERSAND;
+        default: return OP_NONE;
+        }
     }
-};
\ No newline at end of file
+};
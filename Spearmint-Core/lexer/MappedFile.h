@@ -0,0 +1,136 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SPM_HAS_MMAP 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define SPM_HAS_MMAP 0
+#include <fstream>
+#endif
+
+#include "exception/Exception.h"
+
+// Read-only contents of a file on disk. Where the platform supports it the file
+// is memory mapped, otherwise (or if mapping fails) it is read with a single
+// read into a buffer that is sized from the file size up front.
+class MappedFile {
+private:
+    const char* begin = nullptr;
+    size_t length = 0;
+    void* mapping = nullptr;
+    std::string buffer;
+
+    MappedFile() {}
+
+public:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#if SPM_HAS_MMAP
+        if (mapping != nullptr) {
+            munmap(mapping, length);
+        }
+#endif
+    }
+
+    const char* data() {
+        return begin;
+    }
+
+    size_t size() {
+        return length;
+    }
+
+    bool isMapped() {
+        return mapping != nullptr;
+    }
+
+    // Throws if the file does not exist or cannot be read
+    static std::unique_ptr<MappedFile> open(const std::string& fileName) {
+        std::unique_ptr<MappedFile> file(new MappedFile());
+
+#if SPM_HAS_MMAP
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (errno == ENOENT || errno == ENOTDIR) {
+                throw Exception("File: '" + fileName + "' not found.");
+            }
+            throw Exception("File: '" + fileName + "' could not be opened.");
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || S_ISDIR(info.st_mode)) {
+            ::close(fd);
+            throw Exception("File: '" + fileName + "' could not be read.");
+        }
+
+        size_t expected = S_ISREG(info.st_mode) ? (size_t)info.st_size : 0;
+        if (expected > UINT32_MAX) {
+            ::close(fd);
+            throw Exception("File: '" + fileName + "' is too large.");
+        }
+
+        if (expected > 0) {
+            void* addr = mmap(nullptr, expected, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, expected, MADV_SEQUENTIAL);
+                file->mapping = addr;
+                file->begin = (const char*)addr;
+                file->length = expected;
+                ::close(fd);
+                return file;
+            }
+        }
+
+        // Mapping failed or the size is not known up front (pipes, special files)
+        file->buffer.resize(expected > 0 ? expected : 4096);
+        size_t used = 0;
+        while (true) {
+            if (used == file->buffer.size()) {
+                file->buffer.resize(file->buffer.size() * 2);
+            }
+            ssize_t n = ::read(fd, &file->buffer[used], file->buffer.size() - used);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                ::close(fd);
+                throw Exception("File: '" + fileName + "' could not be read.");
+            }
+            if (n == 0) break;
+            used += (size_t)n;
+        }
+        ::close(fd);
+        file->buffer.resize(used);
+#else
+        std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+        if (!in.is_open()) {
+            throw Exception("File: '" + fileName + "' not found.");
+        }
+
+        std::streamoff expected = in.tellg();
+        if (expected < 0 || (uint64_t)expected > UINT32_MAX) {
+            throw Exception("File: '" + fileName + "' could not be read.");
+        }
+        file->buffer.resize((size_t)expected);
+        in.seekg(0);
+        in.read(&file->buffer[0], expected);
+        file->buffer.resize((size_t)in.gcount());
+#endif
+
+        if (file->buffer.size() > UINT32_MAX) {
+            throw Exception("File: '" + fileName + "' is too large.");
+        }
+        file->begin = file->buffer.data();
+        file->length = file->buffer.size();
+        return file;
+    }
+};
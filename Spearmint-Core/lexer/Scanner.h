@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// SSE2 is part of the x86-64 baseline, AVX2 is detected at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+#define SPM_SCANNER_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SPM_TARGET_AVX2
+#else
+#define SPM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define SPM_SCANNER_X86 0
+#endif
+
+// Character classes used by the lexer. Only ASCII letters, digits and '_' can
+// appear in identifiers, independent of the current locale.
+enum CharClass : uint8_t {
+    CHAR_SPACE = 1,
+    CHAR_DIGIT = 2,
+    CHAR_ALPHA = 4,
+    CHAR_IDENT = 8,
+    CHAR_OPERATOR = 16
+};
+
+struct CharTable {
+    uint8_t classes[256] = {};
+
+    CharTable() {
+        classes[(uint8_t)' '] = classes[(uint8_t)'\t'] = classes[(uint8_t)'\n'] = CHAR_SPACE;
+        for (int c = '0'; c <= '9'; c++) classes[c] = CHAR_DIGIT | CHAR_IDENT;
+        for (int c = 'a'; c <= 'z'; c++) classes[c] = CHAR_ALPHA | CHAR_IDENT;
+        for (int c = 'A'; c <= 'Z'; c++) classes[c] = CHAR_ALPHA | CHAR_IDENT;
+        classes[(uint8_t)'_'] = CHAR_ALPHA | CHAR_IDENT;
+        for (char c : std::string_view("+-*/^%=<>!&")) classes[(uint8_t)c] = CHAR_OPERATOR;
+    }
+
+    bool is(char c, uint8_t charClass) const {
+        return (classes[(uint8_t)c] & charClass) != 0;
+    }
+};
+
+inline const CharTable& charTable() {
+    static const CharTable table;
+    return table;
+}
+
+// Scanning kernels. Each one returns a pointer to the first character in
+// [p, end) that does not belong to the run being skipped, or end.
+namespace scanner {
+    typedef const char* (*ScanFunction)(const char* p, const char* end);
+
+    inline int countTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (int)index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    // Scalar versions, also used for the tail of every vector kernel
+    inline const char* whitespaceScalar(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n')) p++;
+        return p;
+    }
+
+    inline const char* lineScalar(const char* p, const char* end) {
+        while (p < end && *p != '\n') p++;
+        return p;
+    }
+
+    inline const char* identifierScalar(const char* p, const char* end) {
+        const CharTable& table = charTable();
+        while (p < end && table.is(*p, CHAR_IDENT)) p++;
+        return p;
+    }
+
+    inline const char* digitsScalar(const char* p, const char* end) {
+        while (p < end && *p >= '0' && *p <= '9') p++;
+        return p;
+    }
+
+    inline const char* stringBodyScalar(const char* p, const char* end) {
+        while (p < end && *p != '"' && *p != '\\' && *p != '\0') p++;
+        return p;
+    }
+
+#if SPM_SCANNER_X86
+    // SSE2: 16 bytes per step. Each kernel builds a mask of the bytes that are
+    // still inside the run and stops at the first byte that is not.
+    inline __m128i inRange16(__m128i v, char lo, char hi) {
+        // Signed compares are fine since every class is 7-bit ASCII
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+    }
+
+    inline const char* whitespaceSSE2(const char* p, const char* end) {
+        while (p + 16 <= end) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+            uint32_t stop = ~(uint32_t)_mm_movemask_epi8(m) & 0xFFFF;
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 16;
+        }
+        return whitespaceScalar(p, end);
+    }
+
+    inline const char* lineSSE2(const char* p, const char* end) {
+        while (p + 16 <= end) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            uint32_t stop = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 16;
+        }
+        return lineScalar(p, end);
+    }
+
+    inline const char* identifierSSE2(const char* p, const char* end) {
+        while (p + 16 <= end) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            __m128i m = _mm_or_si128(_mm_or_si128(inRange16(v, 'a', 'z'), inRange16(v, 'A', 'Z')),
+                _mm_or_si128(inRange16(v, '0', '9'), _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+            uint32_t stop = ~(uint32_t)_mm_movemask_epi8(m) & 0xFFFF;
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 16;
+        }
+        return identifierScalar(p, end);
+    }
+
+    inline const char* digitsSSE2(const char* p, const char* end) {
+        while (p + 16 <= end) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            uint32_t stop = ~(uint32_t)_mm_movemask_epi8(inRange16(v, '0', '9')) & 0xFFFF;
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 16;
+        }
+        return digitsScalar(p, end);
+    }
+
+    inline const char* stringBodySSE2(const char* p, const char* end) {
+        while (p + 16 <= end) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+            uint32_t stop = (uint32_t)_mm_movemask_epi8(m);
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 16;
+        }
+        return stringBodyScalar(p, end);
+    }
+
+    // AVX2: same kernels, 32 bytes per step
+    SPM_TARGET_AVX2 inline __m256i inRange32(__m256i v, char lo, char hi) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+    }
+
+    SPM_TARGET_AVX2 inline const char* whitespaceAVX2(const char* p, const char* end) {
+        while (p + 32 <= end) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+            uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(m);
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 32;
+        }
+        return whitespaceSSE2(p, end);
+    }
+
+    SPM_TARGET_AVX2 inline const char* lineAVX2(const char* p, const char* end) {
+        while (p + 32 <= end) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            uint32_t stop = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 32;
+        }
+        return lineSSE2(p, end);
+    }
+
+    SPM_TARGET_AVX2 inline const char* identifierAVX2(const char* p, const char* end) {
+        while (p + 32 <= end) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            __m256i m = _mm256_or_si256(_mm256_or_si256(inRange32(v, 'a', 'z'), inRange32(v, 'A', 'Z')),
+                _mm256_or_si256(inRange32(v, '0', '9'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'))));
+            uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(m);
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 32;
+        }
+        return identifierSSE2(p, end);
+    }
+
+    SPM_TARGET_AVX2 inline const char* digitsAVX2(const char* p, const char* end) {
+        while (p + 32 <= end) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(inRange32(v, '0', '9'));
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 32;
+        }
+        return digitsSSE2(p, end);
+    }
+
+    SPM_TARGET_AVX2 inline const char* stringBodyAVX2(const char* p, const char* end) {
+        while (p + 32 <= end) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)p);
+            __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+                _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+            uint32_t stop = (uint32_t)_mm256_movemask_epi8(m);
+            if (stop != 0) return p + countTrailingZeros(stop);
+            p += 32;
+        }
+        return stringBodySSE2(p, end);
+    }
+
+    inline bool cpuSupportsAVX2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    // Kernels for the running CPU, picked once on first use
+    struct Kernels {
+        ScanFunction whitespace = whitespaceScalar;
+        ScanFunction line = lineScalar;
+        ScanFunction identifier = identifierScalar;
+        ScanFunction digits = digitsScalar;
+        ScanFunction stringBody = stringBodyScalar;
+
+        Kernels() {
+#if SPM_SCANNER_X86
+            if (cpuSupportsAVX2()) {
+                whitespace = whitespaceAVX2;
+                line = lineAVX2;
+                identifier = identifierAVX2;
+                digits = digitsAVX2;
+                stringBody = stringBodyAVX2;
+            }
+            else {
+                whitespace = whitespaceSSE2;
+                line = lineSSE2;
+                identifier = identifierSSE2;
+                digits = digitsSSE2;
+                stringBody = stringBodySSE2;
+            }
+#endif
+        }
+    };
+
+    inline const Kernels& kernels() {
+        static const Kernels instance;
+        return instance;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "SourceMap.h"
+#include "MappedFile.h"
+
+// Owns the text of a single source file. Tokens only hold views into this buffer,
+// so it has to stay alive for as long as any token produced from it.
+class SourceBuffer : public std::enable_shared_from_this<SourceBuffer> {
+private:
+    std::string fn;
+    std::string text;
+    std::unique_ptr<MappedFile> file;
+    std::string_view contents;
+    SourceMap sourceMap;
+
+    // Storage for string literals that contained escape sequences. A deque never
+    // moves its elements, so views handed out by store() stay valid. Chunks of
+    // one buffer can be lexed on several threads at once, hence the lock.
+    std::deque<std::string> ownedStrings;
+    std::mutex ownedStringsMutex;
+
+public:
+    SourceBuffer(std::string fn, std::string text) {
+        this->fn = fn;
+        this->text = std::move(text);
+        this->contents = std::string_view(this->text);
+        this->sourceMap = SourceMap(fn, contents);
+    }
+
+    // Uses the file contents in place, without copying them
+    SourceBuffer(std::string fn, std::unique_ptr<MappedFile> file) {
+        this->fn = fn;
+        this->file = std::move(file);
+        this->contents = std::string_view(this->file->data(), this->file->size());
+        this->sourceMap = SourceMap(fn, contents);
+    }
+
+    // Throws if the file does not exist or cannot be read
+    static std::shared_ptr<SourceBuffer> fromFile(std::string fileName) {
+        return std::shared_ptr<SourceBuffer>(new SourceBuffer(fileName, MappedFile::open(fileName)));
+    }
+
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+    const std::string& getFileName() {
+        return fn;
+    }
+
+    const char* data() {
+        return contents.data();
+    }
+
+    uint32_t size() {
+        return (uint32_t)contents.size();
+    }
+
+    std::string_view getText() {
+        return contents;
+    }
+
+    std::string_view store(std::string str) {
+        std::lock_guard<std::mutex> lock(ownedStringsMutex);
+        ownedStrings.push_back(std::move(str));
+        return std::string_view(ownedStrings.back());
+    }
+
+    // The returned pointer shares ownership of the whole buffer, so an Exception
+    // holding it can still resolve its location after the lexer and parser are gone.
+    std::shared_ptr<SourceMap> getSourceMap() {
+        return std::shared_ptr<SourceMap>(shared_from_this(), &sourceMap);
+    }
+};
+
+typedef std::shared_ptr<SourceBuffer> SourceBuffer_sPtr;
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+// Location of a token or node as a byte range in its source file
+struct Span {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+
+    Span() {}
+
+    Span(uint32_t offset, uint32_t length) {
+        this->offset = offset;
+        this->length = length;
+    }
+
+    uint32_t end() const {
+        return offset + length;
+    }
+};
+
+// Maps byte offsets of one file back to line and column. The newline index is
+// only built the first time a location is resolved, which normally only happens
+// when an error message is shown.
+class SourceMap {
+private:
+    std::string fn;
+    std::string_view text;
+    std::vector<uint32_t> lineStarts;
+    bool indexed = false;
+
+    void buildIndex() {
+        lineStarts.push_back(0);
+        const char* begin = text.data();
+        const char* end = begin + text.size();
+        for (const char* p = begin; p < end; p++) {
+            p = (const char*)std::memchr(p, '\n', end - p);
+            if (p == nullptr) break;
+            lineStarts.push_back((uint32_t)(p - begin + 1));
+        }
+        indexed = true;
+    }
+
+public:
+    SourceMap() {}
+
+    SourceMap(std::string fn, std::string_view text) {
+        this->fn = fn;
+        this->text = text;
+    }
+
+    const std::string& getFileName() {
+        return fn;
+    }
+
+    int getLine(uint32_t offset) {
+        if (!indexed) buildIndex();
+        return (int)(std::upper_bound(lineStarts.begin(), lineStarts.end(), offset) - lineStarts.begin()) - 1;
+    }
+
+    int getColumn(uint32_t offset) {
+        return (int)(offset - lineStarts.at(getLine(offset)));
+    }
+
+    std::string toString(Span span) {
+        return "at line: " + std::to_string(getLine(span.offset)) + ", col: " + std::to_string(getColumn(span.offset)) +
+            " in File: '" + fn + "'";
+    }
+};
@@ -1,9 +1,10 @@
 #pragma once
 
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <cstdint>
 
-#include "Position.h"
+#include "SourceMap.h"
 
 enum TokenType {
     NEWLINE,
@@ -28,37 +29,85 @@ enum TokenType {
     NULLTYPE
 };
 
+// Keyword and operator tokens carry one of these codes, so the parser and
+// interpreter never have to compare their text
+enum Keyword {
+    KW_NONE,
+    KW_IMPORT,
+    KW_CONST,
+    KW_VAR,
+    KW_IF,
+    KW_ELSE,
+    KW_FOR,
+    KW_WHILE,
+    KW_BREAK,
+    KW_CONTINUE,
+    KW_FN,
+    KW_RETURN,
+    KW_TYPE,
+    KW_NEW,
+    KW_API
+};
+
+enum Operator {
+    OP_NONE,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_POW,
+    OP_MOD,
+    OP_LT,
+    OP_GT,
+    OP_LTE,
+    OP_GTE,
+    OP_EE,
+    OP_NE,
+    OP_AND,
+    OP_OR,
+    OP_NOT,
+    OP_ASSIGN,
+    OP_AMPERSAND,
+    OP_COUNT
+};
+
+// Set of operators for Token::matchesAny
+constexpr uint32_t opMask(int op) {
+    return 1u << op;
+}
+
+// Tokens are small trivially copyable records. The value is a view into the
+// SourceBuffer the token was read from and offset is its byte position in that buffer.
 class Token {
 public:
-    int type;
-    std::string value;
-    Position pos;
+    int16_t type;
+    int16_t code; // Keyword or Operator for KEYWORD and OP tokens
+    uint32_t offset;
+    std::string_view value;
 
     Token() {
         this->type = -1;
+        this->code = 0;
+        this->offset = 0;
         this->value = "NULLTOK";
     }
 
-    Token(int type, char c) {
-        this->type = type;
-        this->value = c;
-    }
-
-    Token(int type, std::string value) {
-        this->type = type;
+    Token(int type, std::string_view value) {
+        this->type = (int16_t)type;
+        this->code = 0;
+        this->offset = 0;
         this->value = value;
     }
 
-    Token(int type, char c, Position& pos) {
-        this->type = type;
-        this->value = c;
-        this->pos = pos.copy();
+    Token(int type, std::string_view value, uint32_t offset, int code = 0) {
+        this->type = (int16_t)type;
+        this->code = (int16_t)code;
+        this->offset = offset;
+        this->value = value;
     }
 
-    Token(int type, std::string value, Position& pos) {
-        this->type = type;
-        this->value = value;
-        this->pos = pos.copy();
+    Span span() {
+        return Span(offset, (uint32_t)value.size());
     }
 
     static Token getNullToken() {
@@ -69,15 +118,15 @@ public:
         return this->type == type;
     }
 
-    bool matches(int type, std::string value) {
-        return this->type == type && (this->value == value);
+    bool matches(int type, int code) {
+        return this->type == type && this->code == code;
     }
 
-    bool matches(int type, std::unordered_set<std::string> valueSet) {
-        return this->type == type && (valueSet.find(this->value) != valueSet.end());
+    bool matchesAny(int type, uint32_t codeMask) {
+        return this->type == type && (opMask(this->code) & codeMask) != 0;
     }
 
     std::string toString() {
-        return "(" + std::to_string(this->type) + ", " + this->value + ")";
+        return "(" + std::to_string(this->type) + ", " + std::string(this->value) + ")";
     }
 };
\ No newline at end of file
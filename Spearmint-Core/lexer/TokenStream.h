@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <cstddef>
+
+#include "Token.h"
+#include "Lexer.h"
+#include "exception/Exception.h"
+
+// Source of tokens for the Parser. Once END has been returned, every
+// further call to next() returns END again.
+class TokenStream {
+public:
+    virtual ~TokenStream() = default;
+
+    virtual Token next() = 0;
+};
+
+// Tokens that were already lexed into a vector
+class VectorTokenStream : public TokenStream {
+private:
+    std::vector<Token>* tokens;
+    size_t index = 0;
+
+public:
+    VectorTokenStream(std::vector<Token>& tokens) {
+        this->tokens = &tokens;
+    }
+
+    Token next() {
+        if (index < tokens->size()) {
+            return tokens->at(index++);
+        }
+        return tokens->empty() ? Token(END, "END") : tokens->back();
+    }
+};
+
+// Lexes on demand, one token per call
+class LexerTokenStream : public TokenStream {
+private:
+    Lexer* lexer;
+
+public:
+    LexerTokenStream(Lexer& lexer) {
+        this->lexer = &lexer;
+    }
+
+    Token next() {
+        return lexer->next();
+    }
+};
+
+// Runs the lexer on a producer thread. Tokens are handed to the parser in
+// fixed size batches through a bounded single-producer/single-consumer ring,
+// so lexing overlaps parsing and only a few batches are alive at any time.
+class PipelinedTokenStream : public TokenStream {
+private:
+    static const size_t BATCH_SIZE = 512;
+    static const size_t RING_SIZE = 8; // Must be a power of two
+
+    struct Batch {
+        Token tokens[BATCH_SIZE];
+        size_t count = 0;
+        bool last = false;
+        std::exception_ptr error = nullptr;
+    };
+
+    Lexer* lexer;
+    Batch ring[RING_SIZE];
+
+    // head is only written by the consumer, tail only by the producer
+    alignas(64) std::atomic<size_t> head{ 0 };
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    std::atomic<bool> cancelled{ false };
+
+    // Consumer state
+    Batch* current = nullptr;
+    size_t position = 0;
+    bool finished = false;
+    Token endToken;
+
+    std::thread producer;
+
+    void produce() {
+        bool done = false;
+        while (!done) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            while (t - head.load(std::memory_order_acquire) == RING_SIZE) {
+                if (cancelled.load(std::memory_order_relaxed)) return;
+                std::this_thread::yield();
+            }
+
+            Batch& batch = ring[t & (RING_SIZE - 1)];
+            batch.count = 0;
+            batch.last = false;
+            batch.error = nullptr;
+            try {
+                while (batch.count < BATCH_SIZE) {
+                    Token tok = lexer->next();
+                    batch.tokens[batch.count++] = tok;
+                    if (tok.matches(END)) {
+                        batch.last = true;
+                        break;
+                    }
+                }
+            }
+            catch (...) {
+                batch.error = std::current_exception();
+                batch.last = true;
+            }
+            done = batch.last;
+            tail.store(t + 1, std::memory_order_release);
+        }
+    }
+
+    void acquireBatch() {
+        size_t h = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == h) {
+            std::this_thread::yield();
+        }
+        current = &ring[h & (RING_SIZE - 1)];
+        position = 0;
+    }
+
+    void releaseBatch() {
+        current = nullptr;
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+public:
+    PipelinedTokenStream(Lexer& lexer) {
+        this->lexer = &lexer;
+        this->endToken = Token(END, "END");
+        this->producer = std::thread(&PipelinedTokenStream::produce, this);
+    }
+
+    PipelinedTokenStream(const PipelinedTokenStream&) = delete;
+    PipelinedTokenStream& operator=(const PipelinedTokenStream&) = delete;
+
+    ~PipelinedTokenStream() {
+        cancelled.store(true, std::memory_order_relaxed);
+        if (producer.joinable()) {
+            producer.join();
+        }
+    }
+
+    Token next() {
+        while (!finished) {
+            if (current == nullptr) {
+                acquireBatch();
+            }
+
+            if (position < current->count) {
+                Token tok = current->tokens[position++];
+                if (tok.matches(END)) {
+                    endToken = tok;
+                    finished = true;
+                    releaseBatch();
+                }
+                return tok;
+            }
+
+            if (current->error != nullptr) {
+                std::exception_ptr error = current->error;
+                finished = true;
+                releaseBatch();
+                std::rethrow_exception(error);
+            }
+            releaseBatch();
+        }
+        return endToken;
+    }
+};
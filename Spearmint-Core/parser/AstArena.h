@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+// Fixed-size array whose items live in an AstArena. It is only a view, copying
+// it never copies the items.
+template<typename T>
+class ArenaArray {
+public:
+    T* items = nullptr;
+    uint32_t count = 0;
+
+    ArenaArray() {}
+
+    ArenaArray(T* items, uint32_t count) {
+        this->items = items;
+        this->count = count;
+    }
+
+    // View of a vector that outlives the array, e.g. the top-level statements
+    ArenaArray(std::vector<T>& vec) {
+        this->items = vec.data();
+        this->count = (uint32_t)vec.size();
+    }
+
+    uint32_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    T& at(uint32_t index) {
+        return items[index];
+    }
+
+    T& operator[](uint32_t index) {
+        return items[index];
+    }
+
+    T* begin() {
+        return items;
+    }
+
+    T* end() {
+        return items + count;
+    }
+};
+
+// Bump allocator owning the AST of one compilation unit. Nodes, child lists
+// and names are carved out of large blocks and never destroyed one by one:
+// the blocks are released together with the arena. Everything allocated
+// here therefore has to be trivially destructible.
+class AstArena {
+private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+
+public:
+    AstArena() {}
+
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+
+    void* allocate(size_t size, size_t alignment) {
+        uintptr_t address = ((uintptr_t)cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (cursor == nullptr || address + size > (uintptr_t)limit) {
+            size_t blockSize = std::max(BLOCK_SIZE, size + alignment);
+            blocks.emplace_back(new char[blockSize]);
+            cursor = blocks.back().get();
+            limit = cursor + blockSize;
+            address = ((uintptr_t)cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        }
+        cursor = (char*)(address + size);
+        return (void*)address;
+    }
+
+    template<typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    ArenaArray<T> array(const std::vector<T>& items) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+        if (items.empty()) {
+            return ArenaArray<T>();
+        }
+        T* copy = (T*)allocate(sizeof(T) * items.size(), alignof(T));
+        std::uninitialized_copy(items.begin(), items.end(), copy);
+        return ArenaArray<T>(copy, (uint32_t)items.size());
+    }
+
+    // Copy of text that stays valid for the lifetime of the arena, so nodes
+    // do not depend on the source buffer they were parsed from
+    std::string_view string(std::string_view text) {
+        if (text.empty()) {
+            return std::string_view();
+        }
+        char* copy = (char*)allocate(text.size(), 1);
+        std::memcpy(copy, text.data(), text.size());
+        return std::string_view(copy, text.size());
+    }
+
+    // Take over the blocks of other, e.g. of a chunk parsed on another thread.
+    // Everything allocated in other now lives as long as this arena.
+    void merge(AstArena& other) {
+        for (std::unique_ptr<char[]>& block : other.blocks) {
+            blocks.push_back(std::move(block));
+        }
+        other.blocks.clear();
+        other.cursor = nullptr;
+        other.limit = nullptr;
+    }
+};
+
+typedef std::shared_ptr<AstArena> AstArena_sPtr;
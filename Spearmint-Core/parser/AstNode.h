@@ -2,9 +2,11 @@
 
 #include <string>
 #include <vector>
-#include <memory>
+#include <string_view>
 
 #include "lexer/Token.h"
+#include "lexer/SourceMap.h"
+#include "AstArena.h"
 
 enum NodeType {
     NODE_IMPORT,
@@ -31,52 +33,73 @@ enum NodeType {
     NODE_ATTRIBUTE_ASSIGN,
     NODE_INDEX_ACCESS,
     NODE_INDEX_ASSIGN,
-    NODE_LIST
+    NODE_LIST,
+    NODE_INLINED_CALL, // Only made in a FlatAst, see Inliner
+    NODE_LOOP_INVARIANT, // Only made in a FlatAst, see LoopInvariantMotion
+    NODE_INCREMENT, // Only made in a FlatAst, see SuperinstructionFuser
+    NODE_COMPARE_CONSTANT, // Only made in a FlatAst, see SuperinstructionFuser
+    NODE_UPDATE_FIELD, // Only made in a FlatAst, see SuperinstructionFuser
+    NODE_PRINT, // Only made in a FlatAst, see SuperinstructionFuser
+    NODE_COUNTED_FOR // Only made in a FlatAst, see SuperinstructionFuser
 };
 
+// Type a variable is annotated with. An annotation names a class the way
+// Object::getType gives it, the last part of a dotted name counts.
+enum ValueType {
+    TYPE_ANY,       // Not annotated
+    TYPE_INT,
+    TYPE_FLOAT,
+    TYPE_STRING,
+    TYPE_BOOLEAN,
+    TYPE_LIST,      // T[] for any T
+    TYPE_NAMED      // Structures and every other class
+};
+
+inline ValueType valueType(std::string_view annotation) {
+    if (annotation.empty()) {
+        return TYPE_ANY;
+    }
+    if (annotation.size() >= 2 && annotation.substr(annotation.size() - 2) == "[]") {
+        return TYPE_LIST;
+    }
+    if (annotation == "Int") {
+        return TYPE_INT;
+    }
+    if (annotation == "Float") {
+        return TYPE_FLOAT;
+    }
+    if (annotation == "String") {
+        return TYPE_STRING;
+    }
+    if (annotation == "Boolean") {
+        return TYPE_BOOLEAN;
+    }
+    return TYPE_NAMED;
+}
+
+// Nodes are allocated in the AstArena of their compilation unit and are
+// never deleted individually. Children are plain pointers into the same
+// arena (or an arena that lives at least as long), names are copied into it.
 class AstNodeBase {
 public:
     int type;
-    Position pos;
+    Span span;
 
     AstNodeBase() {
         this->type = -1;
     }
-
-    virtual ~AstNodeBase() = default;
-
-    virtual std::string toString() {
-        return "Error: AstNode.toString()";
-    }
 };
 
-typedef std::shared_ptr<AstNodeBase> AstNode;
-
-std::string stringListToString(std::vector<std::string>& list) {
-    std::string output;
-
-    for (int i = 0; i < (int)list.size(); i++) {
-        output += list.at(i) + ", ";
-    }
-    return output;
-}
-
-std::string astListToString(std::vector<AstNode>& ast) {
-    std::string output;
-
-    for (int i = 0; i < (int)ast.size(); i++) {
-        output += ast.at(i)->toString() + " ";
-    }
-    return output;
-}
+typedef AstNodeBase* AstNode;
+typedef ArenaArray<AstNode> NodeList;
 
 // This purpose of this is to be able to pass a vector to the
 // visit method of the Interpreter
 class VectorWrapperNode : public AstNodeBase {
 public:
-    std::vector<AstNode> vec;
+    NodeList vec;
     
-    VectorWrapperNode(std::vector<AstNode> vec) {
+    VectorWrapperNode(NodeList vec) {
         this->type = NODE_VECTOR_WRAPPER;
         this->vec = vec;
     }
@@ -89,7 +112,7 @@ public:
 
     IntNode(Token& tok) {
         this->type = NODE_INT;
-        this->value = stoi(tok.value);
+        this->value = std::stoi(std::string(tok.value));
     }
 };
 
@@ -99,28 +122,28 @@ public:
 
     FloatNode(Token& tok) {
         this->type = NODE_FLOAT;
-        this->value = stof(tok.value);
+        this->value = std::stof(std::string(tok.value));
     }
 };
 
 class StringNode : public AstNodeBase {
 public:
-    std::string value;
+    std::string_view value;
 
-    StringNode(Token& tok) {
+    StringNode(std::string_view value) {
         this->type = NODE_STRING;
-        this->value = tok.value;
+        this->value = value;
     }
 };
 
 class UnaryOpNode : public AstNodeBase {
 public:
-    std::string op;
+    int op; // Operator
     AstNode exprNode;
 
     UnaryOpNode(Token& opTok, AstNode exprNode) {
         this->type = NODE_UNARY_OP;
-        this->op = opTok.value;
+        this->op = opTok.code;
         this->exprNode = exprNode;
     }
 };
@@ -128,50 +151,52 @@ public:
 class BinOpNode : public AstNodeBase {
 public:
     AstNode left;
-    std::string op;
+    int op; // Operator
     AstNode right;
 
     BinOpNode(AstNode left, Token& opTok, AstNode right) {
         this->type = NODE_BINARY_OP;
         this->left = left;
-        this->op = opTok.value;
+        this->op = opTok.code;
         this->right = right;
     }
 };
 
 class ImportNode : public AstNodeBase {
 public:
-    std::string fileToImport;
+    std::string_view fileToImport;
 
-    ImportNode(Token& fileNameTok) {
+    ImportNode(std::string_view fileToImport) {
         this->type = NODE_IMPORT;
-        this->fileToImport = fileNameTok.value;
+        this->fileToImport = fileToImport;
     }
 };
 
 class VarDeclarationNode : public AstNodeBase {
 public:
-    std::string varName;
+    std::string_view varName;
     AstNode exprNode;
     bool isConstant;
+    std::string_view typeName; // Empty if not annotated
     
-    VarDeclarationNode(Token& varNameTok, AstNode exprNode, bool isConstant) {
+    VarDeclarationNode(std::string_view varName, AstNode exprNode, bool isConstant, std::string_view typeName) {
         this->type = NODE_VAR_DECLARATION;
-        this->varName = varNameTok.value;
+        this->varName = varName;
         this->exprNode = exprNode;
         this->isConstant = isConstant;
+        this->typeName = typeName;
     }
 };
 
 
 class VarAssignNode : public AstNodeBase {
 public:
-    std::string varName;
+    std::string_view varName;
     AstNode exprNode;
 
-    VarAssignNode(Token& varNameTok, AstNode exprNode) {
+    VarAssignNode(std::string_view varName, AstNode exprNode) {
         this->type = NODE_VAR_ASSIGN;
-        this->varName = varNameTok.value;
+        this->varName = varName;
         this->exprNode = exprNode;
     }
 };
@@ -179,23 +204,22 @@ public:
 
 class VarAccessNode : public AstNodeBase {
 public:
-    std::string varName;
+    std::string_view varName;
 
-    VarAccessNode(Token& tok) {
+    VarAccessNode(std::string_view varName) {
         this->type = NODE_VAR_ACCESS;
-        this->varName = tok.value;
+        this->varName = varName;
     }
 };
 
 
 class IfNode : public AstNodeBase {
 public:
-    std::vector<AstNode> caseConditions;
-    std::vector<std::vector<AstNode>> caseStatements;
-    std::vector<AstNode> elseCaseStatements;
+    NodeList caseConditions;
+    ArenaArray<NodeList> caseStatements;
+    NodeList elseCaseStatements;
 
-    IfNode(std::vector<AstNode>& caseConditions, std::vector<std::vector<AstNode>>& caseStatements,
-        std::vector<AstNode>& elseCaseStatements) {
+    IfNode(NodeList caseConditions, ArenaArray<NodeList> caseStatements, NodeList elseCaseStatements) {
         this->type = NODE_IF;
         this->caseConditions = caseConditions;
         this->caseStatements = caseStatements;
@@ -207,9 +231,9 @@ public:
 class ForNode : public AstNodeBase {
 public:
     AstNode initStatement, condNode, updateStatement;
-    std::vector<AstNode> statements;
+    NodeList statements;
 
-    ForNode(AstNode initStatement, AstNode condNode, AstNode updateStatement, std::vector<AstNode>& statements) {
+    ForNode(AstNode initStatement, AstNode condNode, AstNode updateStatement, NodeList statements) {
         this->type = NODE_FOR;
         this->initStatement = initStatement;
         this->condNode = condNode;
@@ -222,9 +246,9 @@ public:
 class WhileNode : public AstNodeBase {
 public:
     AstNode condNode;
-    std::vector<AstNode> statements;
+    NodeList statements;
 
-    WhileNode(AstNode condNode, std::vector<AstNode>& statements) {
+    WhileNode(AstNode condNode, NodeList statements) {
         this->type = NODE_WHILE;
         this->condNode = condNode;
         this->statements = statements;
@@ -234,25 +258,38 @@ public:
 
 class FunctionDefNode : public AstNodeBase {
 public:
-    std::string name;
-    std::vector<std::string> argNames;
-    std::vector<AstNode> statements;
+    std::string_view name;
+    ArenaArray<std::string_view> argNames;
+    NodeList statements;
+
+    // Set if the parser skipped the body, statements is empty then and body
+    // is the source range between the braces
+    bool lazy = false;
+    Span body;
 
-    FunctionDefNode(Token& functionNameTok, std::vector<std::string>& argNames, std::vector<AstNode>& statements) {
+    FunctionDefNode(std::string_view name, ArenaArray<std::string_view> argNames, NodeList statements) {
         this->type = NODE_FUNCTION_DEF;
-        this->name = functionNameTok.value;
+        this->name = name;
         this->argNames = argNames;
         this->statements = statements;
     }
+
+    FunctionDefNode(std::string_view name, ArenaArray<std::string_view> argNames, Span body) {
+        this->type = NODE_FUNCTION_DEF;
+        this->name = name;
+        this->argNames = argNames;
+        this->lazy = true;
+        this->body = body;
+    }
 };
 
 
 class FunctionCallNode : public AstNodeBase {
 public:
     AstNode nodeToCall;
-    std::vector<AstNode> argNodes;
+    NodeList argNodes;
 
-    FunctionCallNode(AstNode nodeToCall, std::vector<AstNode>& argNodes) {
+    FunctionCallNode(AstNode nodeToCall, NodeList argNodes) {
         this->type = NODE_FUNCTION_CALL;
         this->nodeToCall = nodeToCall;
         this->argNodes = argNodes;
@@ -289,12 +326,12 @@ public:
 
 class StructureDefNode : public AstNodeBase {
 public:
-    std::string name;
-    std::vector<AstNode> statements;
+    std::string_view name;
+    NodeList statements;
 
-    StructureDefNode(Token& structNameTok, std::vector<AstNode>& statements) {
+    StructureDefNode(std::string_view name, NodeList statements) {
         this->type = NODE_STRUCT_DEF;
-        this->name = structNameTok.value;
+        this->name = name;
         this->statements = statements;
     }
 };
@@ -312,20 +349,20 @@ public:
 class AttributeAccessNode : public AstNodeBase {
 public:
     AstNode exprNode;
-    std::string name;
+    std::string_view name;
 
-    AttributeAccessNode(AstNode exprNode, Token& attributeTok) {
+    AttributeAccessNode(AstNode exprNode, std::string_view name) {
         this->type = NODE_ATTRIBUTE_ACCESS;
         this->exprNode = exprNode;
-        this->name = attributeTok.value;
+        this->name = name;
     }
 };
 
 class ListNode : public AstNodeBase {
 public:
-    std::vector<AstNode> listValueNodes;
+    NodeList listValueNodes;
 
-    ListNode(std::vector<AstNode> listValueNodes) {
+    ListNode(NodeList listValueNodes) {
         this->type = NODE_LIST;
         this->listValueNodes = listValueNodes;
     }
@@ -365,4 +402,89 @@ public:
         this->attrNode = attrNode;
         this->exprNode = exprNode;
     }
-};
\ No newline at end of file
+};
+
+// Calls visit(AstNode&) on every direct child of node that is not null
+template<typename F>
+void forEachChild(AstNodeBase* node, F visit) {
+    auto visitAll = [&visit](NodeList& nodes) {
+        for (AstNode& child : nodes) {
+            if (child != nullptr) visit(child);
+        }
+    };
+    auto visitOne = [&visit](AstNode& child) {
+        if (child != nullptr) visit(child);
+    };
+
+    switch (node->type) {
+    case NODE_VECTOR_WRAPPER:
+        visitAll(static_cast<VectorWrapperNode*>(node)->vec);
+        break;
+    case NODE_UNARY_OP:
+        visitOne(static_cast<UnaryOpNode*>(node)->exprNode);
+        break;
+    case NODE_BINARY_OP:
+        visitOne(static_cast<BinOpNode*>(node)->left);
+        visitOne(static_cast<BinOpNode*>(node)->right);
+        break;
+    case NODE_VAR_DECLARATION:
+        visitOne(static_cast<VarDeclarationNode*>(node)->exprNode);
+        break;
+    case NODE_VAR_ASSIGN:
+        visitOne(static_cast<VarAssignNode*>(node)->exprNode);
+        break;
+    case NODE_IF: {
+        IfNode* ifNode = static_cast<IfNode*>(node);
+        for (uint32_t i = 0; i < ifNode->caseConditions.size(); i++) {
+            visitOne(ifNode->caseConditions[i]);
+            visitAll(ifNode->caseStatements[i]);
+        }
+        visitAll(ifNode->elseCaseStatements);
+        break;
+    }
+    case NODE_FOR: {
+        ForNode* forNode = static_cast<ForNode*>(node);
+        visitOne(forNode->initStatement);
+        visitOne(forNode->condNode);
+        visitOne(forNode->updateStatement);
+        visitAll(forNode->statements);
+        break;
+    }
+    case NODE_WHILE:
+        visitOne(static_cast<WhileNode*>(node)->condNode);
+        visitAll(static_cast<WhileNode*>(node)->statements);
+        break;
+    case NODE_FUNCTION_DEF:
+        visitAll(static_cast<FunctionDefNode*>(node)->statements);
+        break;
+    case NODE_FUNCTION_CALL:
+        visitOne(static_cast<FunctionCallNode*>(node)->nodeToCall);
+        visitAll(static_cast<FunctionCallNode*>(node)->argNodes);
+        break;
+    case NODE_RETURN:
+        visitOne(static_cast<ReturnNode*>(node)->exprNode);
+        break;
+    case NODE_STRUCT_DEF:
+        visitAll(static_cast<StructureDefNode*>(node)->statements);
+        break;
+    case NODE_CONSTRUCTOR_CALL:
+        visitOne(static_cast<ConstructorCallNode*>(node)->structureNode);
+        break;
+    case NODE_ATTRIBUTE_ACCESS:
+        visitOne(static_cast<AttributeAccessNode*>(node)->exprNode);
+        break;
+    case NODE_ATTRIBUTE_ASSIGN:
+        visitOne(static_cast<AttributeAssignNode*>(node)->attrNode);
+        visitOne(static_cast<AttributeAssignNode*>(node)->exprNode);
+        break;
+    case NODE_INDEX_ACCESS:
+        visitOne(static_cast<IndexAccessNode*>(node)->node);
+        visitOne(static_cast<IndexAccessNode*>(node)->indexNode);
+        break;
+    case NODE_LIST:
+        visitAll(static_cast<ListNode*>(node)->listValueNodes);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,3017 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <cmath>
+
+#include "exception/Exception.h"
+#include "lexer/SourceMap.h"
+#include "lexer/SourceBuffer.h"
+#include "lexer/MappedFile.h"
+#include "lexer/Lexer.h"
+#include "lexer/TokenStream.h"
+#include "AstArena.h"
+#include "AstNode.h"
+#include "Parser.h"
+
+// Index of a node in a FlatAst
+typedef uint32_t FlatNode;
+const FlatNode NO_NODE = UINT32_MAX;
+
+// Hops of a name that is looked up in the global symbol table, see Resolver
+const uint32_t GLOBAL_SCOPE = UINT32_MAX;
+
+// Functions whose body has at most this many nodes are inlined, see Inliner
+const uint32_t INLINE_MAX_NODES = 40;
+
+// Names of global functions without side effects, whose result only depends
+// on their arguments. Filled in by whoever defines such functions.
+inline std::unordered_set<std::string>& pureFunctions() {
+    static std::unordered_set<std::string> names;
+    return names;
+}
+
+// Value of an INT, FLOAT or STRING row
+struct LiteralValue {
+    uint8_t kind = 0; // Node kind, 0 if there is no value
+    uint32_t value = 0; // Bits of an Int or Float
+    std::string text; // Characters of a String
+};
+
+class FlatAst;
+class FlatAstBuilder;
+
+// Runs the top-level function definition of tree with args and stores what
+// it returns in result. Returns false if the call fails, does not finish
+// within a budget or returns something that is not a literal value.
+typedef bool (*CallEvaluator)(const FlatAst& tree, FlatNode definition, const std::vector<LiteralValue>& args, LiteralValue& result);
+
+// Set by whoever can run code, calls are not evaluated at compile time
+// without it
+inline CallEvaluator& callEvaluator() {
+    static CallEvaluator evaluator = nullptr;
+    return evaluator;
+}
+
+// Items of a child list, see FlatAst::list
+struct FlatList {
+    const uint32_t* items;
+    uint32_t count;
+
+    uint32_t size() const {
+        return count;
+    }
+
+    uint32_t operator[](uint32_t index) const {
+        return items[index];
+    }
+
+    const uint32_t* begin() const {
+        return items;
+    }
+
+    const uint32_t* end() const {
+        return items + count;
+    }
+};
+
+// Column storage of a FlatAst that was built in memory
+struct FlatAstColumns {
+    std::vector<uint8_t> kinds;
+    std::vector<int16_t> ops;
+    std::vector<uint32_t> a, b, c, d, e;
+    std::vector<Span> spans;
+    std::vector<uint32_t> lists;
+
+    // Items of a child list, only valid until lists grows
+    FlatList list(uint32_t ref) const {
+        return FlatList{ lists.data() + ref + 1, lists[ref] };
+    }
+
+    // Value of an INT or FLOAT row as Object::getFloatValue gives it
+    float floatOf(FlatNode node) const {
+        if (kinds[node] == NODE_INT) {
+            return (float)(int)a[node];
+        }
+        float value;
+        std::memcpy(&value, &a[node], sizeof(value));
+        return value;
+    }
+};
+
+// What DeadCodeEliminator removed from a tree
+struct DeadCodeStats {
+    uint32_t branches = 0;      // If cases and loops whose condition is known
+    uint32_t statements = 0;    // Statements after a return, break or continue
+    uint32_t expressions = 0;   // Expression statements without effect
+    uint32_t nodesBefore = 0;
+    uint32_t nodesAfter = 0;
+
+    void add(const DeadCodeStats& other) {
+        branches += other.branches;
+        statements += other.statements;
+        expressions += other.expressions;
+        nodesBefore += other.nodesBefore;
+        nodesAfter += other.nodesAfter;
+    }
+};
+
+// What SuperinstructionFuser fused in a tree
+struct FusionStats {
+    uint32_t increments = 0;
+    uint32_t comparisons = 0;
+    uint32_t fieldUpdates = 0;
+    uint32_t prints = 0;
+    uint32_t countedLoops = 0;
+
+    void add(const FusionStats& other) {
+        increments += other.increments;
+        comparisons += other.comparisons;
+        fieldUpdates += other.fieldUpdates;
+        prints += other.prints;
+        countedLoops += other.countedLoops;
+    }
+};
+
+// What ScalarReplacement replaced in a tree
+struct ScalarReplacementStats {
+    uint32_t instances = 0;
+    uint32_t lists = 0;
+    uint32_t fields = 0; // Locals the fields and items became
+
+    void add(const ScalarReplacementStats& other) {
+        instances += other.instances;
+        lists += other.lists;
+        fields += other.fields;
+    }
+};
+
+// Compact form of an AST that the interpreter runs over. Nodes are rows of
+// a table kept as one array per column and numbered in pre-order, so a
+// statement is followed directly by the nodes it contains. Child lists are
+// ranges in lists, each preceded by its length. Names and string literals
+// are interned in strings.
+//
+// Meaning of the operand columns per kind. Slots, hops and types are filled
+// in by the Resolver, a slot of GLOBAL_SCOPE means the name is global.
+//   INT, FLOAT              a: value bits
+//   STRING                  a: string
+//   IMPORT                  a: string
+//   UNARY_OP                op, a: operand, c: ValueType of the operand if
+//                           the operation is typed
+//   BINARY_OP               op, a: left, b: right, c: ValueTypes of the
+//                           operands as left << 8 | right if the operation
+//                           is typed
+//   VAR_DECLARATION         op: 1 if constant, a: name, b: value, c: slot,
+//                           d: ValueType, e: annotation if d is not TYPE_ANY
+//   VAR_ASSIGN              op: ValueType of the variable, a: name,
+//                           b: value, c: hops, d: slot, e: annotation
+//   VAR_ACCESS              op: ValueType of the variable, a: name, c: hops,
+//                           d: slot
+//   IF                      a: conditions, b: list of bodies, c: else body
+//   FOR                     op: 1 if it has invariants, a: init,
+//                           b: condition, c: update, d: body, e: slots of
+//                           the invariants
+//   WHILE                   op: 1 if it has invariants, a: condition,
+//                           b: body, e: slots of the invariants
+//   FUNCTION_DEF            op: 1 if lazy, a: name, b: list of argument names,
+//                           c: body, or offset of the body in source if lazy,
+//                           d: frame size, or length of the body if lazy,
+//                           e: slot
+//   FUNCTION_CALL           a: callee, b: arguments
+//   RETURN                  a: value or NO_NODE
+//   STRUCT_DEF              a: name, b: body, c: slot
+//   CONSTRUCTOR_CALL        a: structure
+//   ATTRIBUTE_ACCESS        a: object, b: name
+//   ATTRIBUTE_ASSIGN        a: attribute access, b: value
+//   INDEX_ACCESS            a: list, b: index
+//   LIST, VECTOR_WRAPPER    a: items
+//   INLINED_CALL            a: callee, b: arguments, c: first slot of the
+//                           inlined body, d: inlined body, e: definition of
+//                           the callee in the parent tree, or in the tree
+//                           itself for a program
+//   LOOP_INVARIANT          a: expression, c: slot of its value
+// Kinds made by SuperinstructionFuser keep the operands of the kind they
+// were made from:
+//   INCREMENT               VAR_ASSIGN of x = x + n or x = x - n
+//   COMPARE_CONSTANT        BINARY_OP comparing a VAR_ACCESS to an INT
+//   UPDATE_FIELD            ATTRIBUTE_ASSIGN of v.f = v.f op value, where v
+//                           is a VAR_ACCESS
+//   PRINT                   op: 1 for println, FUNCTION_CALL of print or
+//                           println with one argument
+//   COUNTED_FOR             op: 1 if it has invariants, plus 2 if the body
+//                           reads the counter, FOR that counts a local up or
+//                           down by a constant step
+class FlatAst {
+public:
+    // Views of the columns. They point into either columns or file.
+    const uint8_t* kinds = nullptr;
+    const int16_t* ops = nullptr;
+    const uint32_t* a = nullptr;
+    const uint32_t* b = nullptr;
+    const uint32_t* c = nullptr;
+    const uint32_t* d = nullptr;
+    const uint32_t* e = nullptr;
+    const Span* spans = nullptr; // Only read when reporting errors
+    const uint32_t* lists = nullptr;
+    uint32_t nodeCount = 0;
+    uint32_t listsSize = 0;
+    std::vector<std::string> strings;
+
+    // Top-level statements
+    uint32_t program = 0;
+
+    // Slots of the frame the top-level statements run in. Only variables of
+    // blocks get one, the top level itself declares globals.
+    uint32_t frameSize = 0;
+
+    // Text the program was parsed from, lazy function bodies are read from it
+    SourceBuffer_sPtr source;
+
+    // Tree this body was compiled from, null for a whole program
+    const FlatAst* parent = nullptr;
+
+    // Whether the frame the statements run in may be referred to after they
+    // finish. Only functions and structures defined in them close over it,
+    // so a compiled body without either lets the interpreter reuse its frame.
+    bool frameEscapes = true;
+
+    // Removed by the build of this tree and of the bodies compiled from it so
+    // far. Not kept in the program cache.
+    mutable DeadCodeStats deadCode;
+
+    // Fused by the build of this tree and of the bodies compiled from it so
+    // far. Not kept in the program cache.
+    mutable FusionStats fusions;
+
+    // Replaced in the bodies compiled from this tree so far. Not kept in the
+    // program cache.
+    mutable ScalarReplacementStats scalarReplacement;
+
+private:
+    std::unique_ptr<FlatAstColumns> columns;
+    std::unique_ptr<MappedFile> file;
+    mutable std::unordered_map<FlatNode, std::unique_ptr<FlatAst>> compiledBodies;
+    mutable std::unordered_set<FlatNode> compiling; // Bodies being compiled, they are not inlined
+    mutable std::unique_ptr<std::vector<FlatNode>> constants;
+    mutable std::unique_ptr<std::unordered_map<std::string, FlatNode>> functions;
+    mutable std::unique_ptr<std::unordered_map<std::string, FlatNode>> structures;
+    mutable std::unordered_map<FlatNode, bool> purity; // Of top-level definitions
+    mutable std::unordered_map<std::string, LiteralValue> evaluations; // By definition and arguments
+
+public:
+    FlatAst() {}
+
+    FlatAst(std::unique_ptr<FlatAstColumns> columns, std::vector<std::string> strings, uint32_t program, uint32_t frameSize) {
+        this->kinds = columns->kinds.data();
+        this->ops = columns->ops.data();
+        this->a = columns->a.data();
+        this->b = columns->b.data();
+        this->c = columns->c.data();
+        this->d = columns->d.data();
+        this->e = columns->e.data();
+        this->spans = columns->spans.data();
+        this->lists = columns->lists.data();
+        this->nodeCount = (uint32_t)columns->kinds.size();
+        this->listsSize = (uint32_t)columns->lists.size();
+        this->strings = std::move(strings);
+        this->program = program;
+        this->frameSize = frameSize;
+        this->columns = std::move(columns);
+    }
+
+    FlatAst(const FlatAst&) = delete;
+    FlatAst& operator=(const FlatAst&) = delete;
+    FlatAst(FlatAst&&) = default;
+    FlatAst& operator=(FlatAst&&) = default;
+
+    // Keep the file the column views point into alive
+    void setFile(std::unique_ptr<MappedFile> file) {
+        this->file = std::move(file);
+    }
+
+    uint32_t size() const {
+        return nodeCount;
+    }
+
+    FlatList list(uint32_t ref) const {
+        return FlatList{ &lists[ref + 1], lists[ref] };
+    }
+
+    int intValue(FlatNode node) const {
+        return (int)a[node];
+    }
+
+    float floatValue(FlatNode node) const {
+        float value;
+        std::memcpy(&value, &a[node], sizeof(value));
+        return value;
+    }
+
+    const std::string& string(uint32_t index) const {
+        return strings[index];
+    }
+
+    // Tree of the body of a lazy FUNCTION_DEF node, its program runs in the
+    // frame of the function. It is parsed on the first request and lives as
+    // long as this tree.
+    const FlatAst& compileBody(FlatNode node) const;
+
+    // Top-level constants bound to a literal, they are known inside lazily
+    // compiled bodies as well
+    const std::vector<FlatNode>& literalConstants() const;
+
+    // Definition of each function declared at the top level by name
+    const std::unordered_map<std::string, FlatNode>& topLevelFunctions() const;
+
+    // Definition of each structure declared at the top level by name
+    const std::unordered_map<std::string, FlatNode>& topLevelStructures() const;
+
+    // Whether the body of the lazy FUNCTION_DEF node is being compiled
+    bool isCompiling(FlatNode node) const {
+        return compiling.find(node) != compiling.end();
+    }
+
+    // Whether the top-level FUNCTION_DEF node can be run at compile time.
+    // Its body has to be compiled lazily. It may only read its own locals,
+    // true, false, null, pureFunctions() and the function itself, which is
+    // known to be bound to it while a call of it runs. Other functions may
+    // have been assigned another value by then. It may not define, import,
+    // construct or assign anything outside of its frame, and it may not
+    // build lists.
+    // Dividing an Int by zero crashes the interpreter, so a division is only
+    // allowed if one operand is known to be a Float.
+    bool isPure(FlatNode definition) const;
+
+    // Result of calling the pure top-level FUNCTION_DEF node with args, see
+    // CallEvaluator. Results, and calls that could not be evaluated, are
+    // remembered.
+    bool evaluateCall(FlatNode definition, const std::vector<LiteralValue>& args, LiteralValue& result) const;
+
+    // Flatten the statements of a parsed program
+    static FlatAst build(std::vector<AstNode>& statements, SourceBuffer_sPtr source);
+
+    // Tree reading the columns of builder while it is not changed
+    static FlatAst view(const FlatAstBuilder& builder, uint32_t program, uint32_t frameSize, SourceBuffer_sPtr source);
+};
+
+// Appends AST nodes to a FlatAst in pre-order
+class FlatAstBuilder {
+public:
+    FlatAstColumns columns;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> stringIndex;
+
+    uint32_t intern(std::string_view text) {
+        auto inserted = stringIndex.emplace(std::string(text), (uint32_t)strings.size());
+        if (inserted.second) {
+            strings.emplace_back(text);
+        }
+        return inserted.first->second;
+    }
+
+    // Append a row, returns its index. Every pass adds its rows through here.
+    FlatNode row(uint8_t kind, int16_t op, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e, Span span) {
+        FlatNode index = (FlatNode)columns.kinds.size();
+        columns.kinds.push_back(kind);
+        columns.ops.push_back(op);
+        columns.a.push_back(a);
+        columns.b.push_back(b);
+        columns.c.push_back(c);
+        columns.d.push_back(d);
+        columns.e.push_back(e);
+        columns.spans.push_back(span);
+        return index;
+    }
+
+    // Append a copy of row node of from, which may be these columns
+    FlatNode copyRow(const FlatAstColumns& from, FlatNode node) {
+        return row(from.kinds[node], from.ops[node], from.a[node], from.b[node], from.c[node], from.d[node], from.e[node], from.spans[node]);
+    }
+
+    uint32_t list(std::vector<uint32_t>& items) {
+        uint32_t ref = (uint32_t)columns.lists.size();
+        columns.lists.push_back((uint32_t)items.size());
+        columns.lists.insert(columns.lists.end(), items.begin(), items.end());
+        return ref;
+    }
+
+    uint32_t nodeList(NodeList nodes) {
+        std::vector<uint32_t> items;
+        items.reserve(nodes.size());
+        for (AstNode item : nodes) {
+            items.push_back(node(item));
+        }
+        return list(items);
+    }
+
+    // Append node and its subtree, returns its index
+    FlatNode node(AstNode node) {
+        if (node == nullptr) {
+            return NO_NODE;
+        }
+
+        FlatNode index = row((uint8_t)node->type, 0, 0, 0, 0, 0, 0, node->span);
+
+        // Children are appended after the node. The columns may reallocate
+        // while a child is added, which is fine because the right-hand side
+        // of an assignment is evaluated first.
+        switch (node->type) {
+        case NODE_VECTOR_WRAPPER:
+            columns.a[index] = nodeList(static_cast<VectorWrapperNode*>(node)->vec);
+            break;
+        case NODE_INT:
+            columns.a[index] = (uint32_t)static_cast<IntNode*>(node)->value;
+            break;
+        case NODE_FLOAT: {
+            float value = static_cast<FloatNode*>(node)->value;
+            std::memcpy(&columns.a[index], &value, sizeof(value));
+            break;
+        }
+        case NODE_STRING:
+            columns.a[index] = intern(static_cast<StringNode*>(node)->value);
+            break;
+        case NODE_IMPORT:
+            columns.a[index] = intern(static_cast<ImportNode*>(node)->fileToImport);
+            break;
+        case NODE_UNARY_OP: {
+            UnaryOpNode* unaryOpNode = static_cast<UnaryOpNode*>(node);
+            columns.ops[index] = (int16_t)unaryOpNode->op;
+            columns.a[index] = this->node(unaryOpNode->exprNode);
+            break;
+        }
+        case NODE_BINARY_OP: {
+            BinOpNode* binOpNode = static_cast<BinOpNode*>(node);
+            columns.ops[index] = (int16_t)binOpNode->op;
+            columns.a[index] = this->node(binOpNode->left);
+            columns.b[index] = this->node(binOpNode->right);
+            break;
+        }
+        case NODE_VAR_DECLARATION: {
+            VarDeclarationNode* varNode = static_cast<VarDeclarationNode*>(node);
+            columns.ops[index] = varNode->isConstant ? 1 : 0;
+            columns.a[index] = intern(varNode->varName);
+            columns.b[index] = this->node(varNode->exprNode);
+            columns.d[index] = valueType(varNode->typeName);
+            if (columns.d[index] != TYPE_ANY) {
+                columns.e[index] = intern(varNode->typeName);
+            }
+            break;
+        }
+        case NODE_VAR_ASSIGN: {
+            VarAssignNode* varNode = static_cast<VarAssignNode*>(node);
+            columns.a[index] = intern(varNode->varName);
+            columns.b[index] = this->node(varNode->exprNode);
+            break;
+        }
+        case NODE_VAR_ACCESS:
+            columns.a[index] = intern(static_cast<VarAccessNode*>(node)->varName);
+            break;
+        case NODE_IF: {
+            IfNode* ifNode = static_cast<IfNode*>(node);
+            std::vector<uint32_t> conditions, bodies;
+            for (uint32_t i = 0; i < ifNode->caseConditions.size(); i++) {
+                conditions.push_back(this->node(ifNode->caseConditions[i]));
+                bodies.push_back(nodeList(ifNode->caseStatements[i]));
+            }
+            columns.a[index] = list(conditions);
+            columns.b[index] = list(bodies);
+            columns.c[index] = nodeList(ifNode->elseCaseStatements);
+            break;
+        }
+        case NODE_FOR: {
+            ForNode* forNode = static_cast<ForNode*>(node);
+            columns.a[index] = this->node(forNode->initStatement);
+            columns.b[index] = this->node(forNode->condNode);
+            columns.c[index] = this->node(forNode->updateStatement);
+            columns.d[index] = nodeList(forNode->statements);
+            break;
+        }
+        case NODE_WHILE: {
+            WhileNode* whileNode = static_cast<WhileNode*>(node);
+            columns.a[index] = this->node(whileNode->condNode);
+            columns.b[index] = nodeList(whileNode->statements);
+            break;
+        }
+        case NODE_FUNCTION_DEF: {
+            FunctionDefNode* funDefNode = static_cast<FunctionDefNode*>(node);
+            std::vector<uint32_t> argNames;
+            for (std::string_view argName : funDefNode->argNames) {
+                argNames.push_back(intern(argName));
+            }
+            columns.a[index] = intern(funDefNode->name);
+            columns.b[index] = list(argNames);
+            if (funDefNode->lazy) {
+                columns.ops[index] = 1;
+                columns.c[index] = funDefNode->body.offset;
+                columns.d[index] = funDefNode->body.length;
+            }
+            else {
+                columns.c[index] = nodeList(funDefNode->statements);
+            }
+            break;
+        }
+        case NODE_FUNCTION_CALL: {
+            FunctionCallNode* funCallNode = static_cast<FunctionCallNode*>(node);
+            columns.a[index] = this->node(funCallNode->nodeToCall);
+            columns.b[index] = nodeList(funCallNode->argNodes);
+            break;
+        }
+        case NODE_RETURN:
+            columns.a[index] = this->node(static_cast<ReturnNode*>(node)->exprNode);
+            break;
+        case NODE_STRUCT_DEF: {
+            StructureDefNode* structDefNode = static_cast<StructureDefNode*>(node);
+            columns.a[index] = intern(structDefNode->name);
+            columns.b[index] = nodeList(structDefNode->statements);
+            break;
+        }
+        case NODE_CONSTRUCTOR_CALL:
+            columns.a[index] = this->node(static_cast<ConstructorCallNode*>(node)->structureNode);
+            break;
+        case NODE_ATTRIBUTE_ACCESS: {
+            AttributeAccessNode* attrAccessNode = static_cast<AttributeAccessNode*>(node);
+            columns.a[index] = this->node(attrAccessNode->exprNode);
+            columns.b[index] = intern(attrAccessNode->name);
+            break;
+        }
+        case NODE_ATTRIBUTE_ASSIGN: {
+            AttributeAssignNode* attrAssignNode = static_cast<AttributeAssignNode*>(node);
+            columns.a[index] = this->node(attrAssignNode->attrNode);
+            columns.b[index] = this->node(attrAssignNode->exprNode);
+            break;
+        }
+        case NODE_INDEX_ACCESS: {
+            IndexAccessNode* indexAccessNode = static_cast<IndexAccessNode*>(node);
+            columns.a[index] = this->node(indexAccessNode->node);
+            columns.b[index] = this->node(indexAccessNode->indexNode);
+            break;
+        }
+        case NODE_LIST:
+            columns.a[index] = nodeList(static_cast<ListNode*>(node)->listValueNodes);
+            break;
+        default:
+            break;
+        }
+        return index;
+    }
+};
+
+// Assigns every local variable a slot in the frame of the function that
+// declares it and tells each use where to find it: hops is the number of
+// frames to go up from the current one, slot the index in that frame. Blocks
+// share the frame of their function and every declaration has a slot of its
+// own, so a frame that outlives a block never sees its slots reused.
+//
+// Names declared at the top level are globals and stay in the global symbol
+// table, as do names that are not declared anywhere here. Those may come
+// from another module, see Interpreter::checkGlobals.
+//
+// Like the interpreter, a declaration is visible from the statement after
+// it. Function bodies are resolved at the end of the block defining them, so
+// they see everything declared in that block.
+//
+// Operations on literals are folded into a literal row, with the results the
+// Int, Float and String classes give at run time. Uses of constants that are
+// bound to a literal become that literal. Rows that are no longer reachable
+// are left for DeadCodeEliminator.
+//
+// Uses of annotated variables are given the variable's type. The interpreter
+// checks every value stored in such a variable, so an arithmetic operation or
+// comparison whose operands are all literals, annotated variables or typed
+// operations on Int and Float is marked typed and runs without dispatch. A
+// value whose type is known here and does not fit is reported right away.
+class Resolver {
+public:
+    // Constant declared outside of the tree being resolved
+    struct Constant {
+        uint32_t name;
+        uint8_t kind;
+        uint32_t value;
+    };
+
+private:
+    struct Binding {
+        uint32_t slot;
+        bool constant;
+        uint8_t literalKind; // NODE_INT, NODE_FLOAT or NODE_STRING if bound to a literal, 0 otherwise
+        uint32_t literalValue;
+        uint8_t type; // ValueType of the annotation
+        uint32_t annotation; // String of the annotation if typed
+        uint32_t offset; // Source offset of the declaration
+    };
+
+    struct Block {
+        std::unordered_map<uint32_t, Binding> names; // By string index
+        std::vector<FlatNode> functions; // Definitions whose bodies are resolved at the end
+    };
+
+    struct Function {
+        std::vector<Block> blocks;
+        uint32_t frameSize = 0;
+        uint32_t definedAt = UINT32_MAX; // Source offset of the definition
+    };
+
+    FlatAstBuilder& builder;
+    FlatAstColumns& columns;
+    const std::vector<std::string>& strings;
+    SourceBuffer_sPtr source;
+    std::vector<Function> functions; // The first one is the top level, its first block the global scope
+
+    std::vector<uint32_t> items(uint32_t listRef) {
+        uint32_t count = columns.lists[listRef];
+        return std::vector<uint32_t>(columns.lists.begin() + listRef + 1, columns.lists.begin() + listRef + 1 + count);
+    }
+
+    Exception error(std::string message, FlatNode node) {
+        if (source == nullptr || node == NO_NODE) {
+            return Exception(message);
+        }
+        return Exception(message, source->getSourceMap(), columns.spans[node]);
+    }
+
+    bool inGlobalScope() {
+        return functions.size() == 1 && functions[0].blocks.size() == 1;
+    }
+
+    // Returns the slot of the new variable
+    uint32_t declare(uint32_t name, bool constant, FlatNode node) {
+        Block& block = functions.back().blocks.back();
+        if (block.names.find(name) != block.names.end()) {
+            throw error("'" + strings[name] + "' is already in scope.", node);
+        }
+        uint32_t slot = inGlobalScope() ? GLOBAL_SCOPE : functions.back().frameSize++;
+        block.names[name] = Binding{ slot, constant, 0, 0, TYPE_ANY, 0, node == NO_NODE ? 0 : columns.spans[node].offset };
+        return slot;
+    }
+
+    // Fills in hops and slot, returns the binding if the name is declared here
+    const Binding* lookup(uint32_t name, uint32_t& hops, uint32_t& slot) {
+        for (size_t f = functions.size(); f-- > 0;) {
+            std::vector<Block>& blocks = functions[f].blocks;
+            for (size_t b = blocks.size(); b-- > 0;) {
+                auto found = blocks[b].names.find(name);
+                if (found != blocks[b].names.end()) {
+                    hops = found->second.slot == GLOBAL_SCOPE ? GLOBAL_SCOPE : (uint32_t)(functions.size() - 1 - f);
+                    slot = found->second.slot;
+                    return &found->second;
+                }
+            }
+        }
+        hops = GLOBAL_SCOPE;
+        slot = GLOBAL_SCOPE;
+        return nullptr;
+    }
+
+    // Whether binding has been declared whenever the current function runs. A
+    // function can be called before a declaration that follows its definition,
+    // so uses of such a constant keep reading the variable.
+    bool declaredBefore(const Binding& binding, uint32_t hops) {
+        size_t level = hops == GLOBAL_SCOPE ? 0 : functions.size() - 1 - hops;
+        return level == functions.size() - 1 || binding.offset < functions[level + 1].definedAt;
+    }
+
+    bool isLiteral(FlatNode node) {
+        uint8_t kind = columns.kinds[node];
+        return kind == NODE_INT || kind == NODE_FLOAT || kind == NODE_STRING;
+    }
+
+    int intOf(FlatNode node) {
+        return (int)columns.a[node];
+    }
+
+    // Text as Object::toString gives it
+    std::string stringOf(FlatNode node) {
+        switch (columns.kinds[node]) {
+        case NODE_INT:
+            return std::to_string(intOf(node));
+        case NODE_FLOAT:
+            return std::to_string(columns.floatOf(node));
+        default:
+            return strings[columns.a[node]];
+        }
+    }
+
+    void setLiteral(FlatNode node, uint8_t kind, uint32_t value) {
+        columns.kinds[node] = kind;
+        columns.ops[node] = 0;
+        columns.a[node] = value;
+    }
+
+    void setInt(FlatNode node, int value) {
+        setLiteral(node, NODE_INT, (uint32_t)value);
+    }
+
+    void setFloat(FlatNode node, float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        setLiteral(node, NODE_FLOAT, bits);
+    }
+
+    void foldUnary(FlatNode node) {
+        FlatNode operand = columns.a[node];
+        if (columns.ops[node] != OP_SUB) {
+            return;
+        }
+        // Negation multiplies by Int(-1)
+        if (columns.kinds[operand] == NODE_INT) {
+            setInt(node, (int)((uint32_t)intOf(operand) * (uint32_t)-1));
+        }
+        else if (columns.kinds[operand] == NODE_FLOAT) {
+            setFloat(node, columns.floatOf(operand) * -1.0f);
+        }
+    }
+
+    // Operations that would throw or that give a Boolean are left alone
+    void foldBinary(FlatNode node) {
+        FlatNode left = columns.a[node];
+        FlatNode right = columns.b[node];
+        if (!isLiteral(left) || !isLiteral(right)) {
+            return;
+        }
+
+        uint8_t leftKind = columns.kinds[left];
+        uint8_t rightKind = columns.kinds[right];
+        bool ints = leftKind == NODE_INT && rightKind == NODE_INT;
+        bool numbers = leftKind != NODE_STRING && rightKind != NODE_STRING;
+        uint32_t l = (uint32_t)intOf(left), r = (uint32_t)intOf(right);
+
+        switch (columns.ops[node]) {
+        case OP_ADD:
+            if (!numbers) {
+                std::string text = stringOf(left) + stringOf(right);
+                setLiteral(node, NODE_STRING, builder.intern(text));
+            }
+            else if (ints) {
+                setInt(node, (int)(l + r));
+            }
+            else {
+                setFloat(node, columns.floatOf(left) + columns.floatOf(right));
+            }
+            break;
+        case OP_SUB:
+            if (ints) {
+                setInt(node, (int)(l - r));
+            }
+            else if (numbers) {
+                setFloat(node, columns.floatOf(left) - columns.floatOf(right));
+            }
+            break;
+        case OP_MUL:
+            if (ints) {
+                setInt(node, (int)(l * r));
+            }
+            else if (numbers) {
+                setFloat(node, columns.floatOf(left) * columns.floatOf(right));
+            }
+            break;
+        case OP_DIV:
+            if (ints) {
+                if (intOf(right) != 0 && !(intOf(left) == INT_MIN && intOf(right) == -1)) {
+                    setInt(node, intOf(left) / intOf(right));
+                }
+            }
+            else if (numbers) {
+                setFloat(node, columns.floatOf(left) / columns.floatOf(right));
+            }
+            break;
+        case OP_POW:
+            if (numbers && rightKind == NODE_INT) {
+                setFloat(node, (float)std::pow(columns.floatOf(left), intOf(right)));
+            }
+            break;
+        case OP_MOD:
+            // Int % Float is an error, every other mix gives a Float
+            if (numbers && !(leftKind == NODE_INT && rightKind == NODE_FLOAT)) {
+                setFloat(node, std::fmod(columns.floatOf(left), columns.floatOf(right)));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    static bool isNumber(uint8_t type) {
+        return type == TYPE_INT || type == TYPE_FLOAT;
+    }
+
+    static bool isComparison(int op) {
+        return op >= OP_LT && op <= OP_NE;
+    }
+
+    // Type node has whenever it runs, TYPE_ANY if that is not known
+    uint8_t typeOf(FlatNode node) {
+        switch (columns.kinds[node]) {
+        case NODE_INT:
+            return TYPE_INT;
+        case NODE_FLOAT:
+            return TYPE_FLOAT;
+        case NODE_STRING:
+            return TYPE_STRING;
+        case NODE_VAR_ACCESS:
+        case NODE_VAR_ASSIGN:
+            return (uint8_t)columns.ops[node];
+        case NODE_UNARY_OP:
+            return (uint8_t)columns.c[node];
+        case NODE_BINARY_OP: {
+            uint32_t operands = columns.c[node];
+            if (operands == 0) {
+                return TYPE_ANY;
+            }
+            int op = columns.ops[node];
+            if (isComparison(op)) {
+                return TYPE_BOOLEAN;
+            }
+            if (op == OP_POW || op == OP_MOD || operands != (TYPE_INT << 8 | TYPE_INT)) {
+                return TYPE_FLOAT;
+            }
+            return TYPE_INT;
+        }
+        default:
+            return TYPE_ANY;
+        }
+    }
+
+    void typeUnary(FlatNode node) {
+        if (columns.kinds[node] != NODE_UNARY_OP || columns.ops[node] != OP_SUB) {
+            return;
+        }
+        uint8_t operand = typeOf(columns.a[node]);
+        if (isNumber(operand)) {
+            columns.c[node] = operand;
+        }
+    }
+
+    // Only operations the Int and Float classes allow for the operand types
+    // are typed, the rest keep throwing at run time
+    void typeBinary(FlatNode node) {
+        if (columns.kinds[node] != NODE_BINARY_OP) {
+            return;
+        }
+        uint8_t left = typeOf(columns.a[node]);
+        uint8_t right = typeOf(columns.b[node]);
+        int op = columns.ops[node];
+        if (!isNumber(left) || !isNumber(right) || op < OP_ADD || op > OP_NE) {
+            return;
+        }
+        if ((op == OP_POW && right != TYPE_INT) || (op == OP_MOD && left == TYPE_INT && right != TYPE_INT)) {
+            return;
+        }
+        columns.c[node] = (uint32_t)left << 8 | right;
+    }
+
+    // Reports a value of a known type that does not fit the annotation. Lists
+    // and named classes may also be null, which only the run time check can
+    // tell, so they are left to it.
+    void checkType(FlatNode node, uint8_t type, FlatNode value) {
+        uint8_t valueType = typeOf(value);
+        if (type == TYPE_ANY || valueType == TYPE_ANY || valueType > TYPE_BOOLEAN || valueType == type) {
+            return;
+        }
+        const char* names[] = { "", "Int", "Float", "String", "Boolean" };
+        throw error("'" + strings[columns.a[node]] + "' is declared as " + strings[columns.e[node]] + " but is given " + names[valueType] + ".", node);
+    }
+
+    void pushBlock() {
+        functions.back().blocks.emplace_back();
+    }
+
+    void popBlock() {
+        // The vector may grow while the bodies are resolved
+        std::vector<FlatNode> bodies = std::move(functions.back().blocks.back().functions);
+        for (FlatNode definition : bodies) {
+            functionBody(definition);
+        }
+        functions.back().blocks.pop_back();
+    }
+
+    void functionBody(FlatNode definition) {
+        if (columns.ops[definition] != 0) {
+            return; // Lazy, resolved by FlatAst::compileBody
+        }
+        functions.emplace_back();
+        functions.back().definedAt = columns.spans[definition].offset;
+        pushBlock();
+        for (uint32_t argName : items(columns.b[definition])) {
+            declare(argName, false, definition);
+        }
+        statements(columns.c[definition]);
+        popBlock();
+        columns.d[definition] = functions.back().frameSize;
+        functions.pop_back();
+    }
+
+    void statements(uint32_t listRef) {
+        for (FlatNode node : items(listRef)) {
+            resolve(node);
+        }
+    }
+
+    void block(uint32_t listRef) {
+        pushBlock();
+        statements(listRef);
+        popBlock();
+    }
+
+    void resolve(FlatNode node) {
+        if (node == NO_NODE) {
+            return;
+        }
+
+        switch (columns.kinds[node]) {
+        case NODE_VECTOR_WRAPPER:
+        case NODE_LIST:
+            statements(columns.a[node]);
+            break;
+        case NODE_UNARY_OP:
+            resolve(columns.a[node]);
+            foldUnary(node);
+            typeUnary(node);
+            break;
+        case NODE_RETURN:
+        case NODE_CONSTRUCTOR_CALL:
+        case NODE_ATTRIBUTE_ACCESS:
+            resolve(columns.a[node]);
+            break;
+        case NODE_BINARY_OP:
+            resolve(columns.a[node]);
+            resolve(columns.b[node]);
+            foldBinary(node);
+            typeBinary(node);
+            break;
+        case NODE_INDEX_ACCESS:
+            resolve(columns.a[node]);
+            resolve(columns.b[node]);
+            break;
+        case NODE_ATTRIBUTE_ASSIGN:
+            resolve(columns.a[columns.a[node]]);
+            resolve(columns.b[node]);
+            break;
+        case NODE_VAR_DECLARATION: {
+            resolve(columns.b[node]);
+            FlatNode value = columns.b[node];
+            checkType(node, (uint8_t)columns.d[node], value);
+            columns.c[node] = declare(columns.a[node], columns.ops[node] != 0, node);
+            Binding& binding = functions.back().blocks.back().names[columns.a[node]];
+            binding.type = (uint8_t)columns.d[node];
+            binding.annotation = columns.e[node];
+            if (columns.ops[node] != 0 && isLiteral(value)) {
+                binding.literalKind = columns.kinds[value];
+                binding.literalValue = columns.a[value];
+            }
+            break;
+        }
+        case NODE_VAR_ASSIGN: {
+            resolve(columns.b[node]);
+            const Binding* binding = lookup(columns.a[node], columns.c[node], columns.d[node]);
+            if (binding != nullptr && binding->constant) {
+                throw error("Value cannot be reassigned. Variable '" + strings[columns.a[node]] + "' is declared as constant.", node);
+            }
+            if (binding != nullptr && binding->type != TYPE_ANY) {
+                columns.ops[node] = binding->type;
+                columns.e[node] = binding->annotation;
+                checkType(node, binding->type, columns.b[node]);
+            }
+            break;
+        }
+        case NODE_VAR_ACCESS: {
+            const Binding* binding = lookup(columns.a[node], columns.c[node], columns.d[node]);
+            if (binding != nullptr && binding->literalKind != 0 && declaredBefore(*binding, columns.c[node])) {
+                setLiteral(node, binding->literalKind, binding->literalValue);
+            }
+            else if (binding != nullptr) {
+                columns.ops[node] = binding->type;
+            }
+            break;
+        }
+        case NODE_IF: {
+            for (FlatNode condition : items(columns.a[node])) {
+                resolve(condition);
+            }
+            for (uint32_t body : items(columns.b[node])) {
+                block(body);
+            }
+            block(columns.c[node]);
+            break;
+        }
+        case NODE_FOR:
+            // The update runs in the scope of the body
+            pushBlock();
+            resolve(columns.a[node]);
+            resolve(columns.b[node]);
+            pushBlock();
+            statements(columns.d[node]);
+            resolve(columns.c[node]);
+            popBlock();
+            popBlock();
+            break;
+        case NODE_WHILE:
+            resolve(columns.a[node]);
+            block(columns.b[node]);
+            break;
+        case NODE_FUNCTION_DEF:
+            columns.e[node] = declare(columns.a[node], false, node);
+            functions.back().blocks.back().functions.push_back(node);
+            break;
+        case NODE_FUNCTION_CALL:
+            resolve(columns.a[node]);
+            statements(columns.b[node]);
+            break;
+        case NODE_STRUCT_DEF:
+            // Fields are not variables, only their values and the methods are resolved
+            columns.c[node] = declare(columns.a[node], true, node);
+            for (FlatNode item : items(columns.b[node])) {
+                if (columns.kinds[item] == NODE_VAR_DECLARATION) {
+                    resolve(columns.b[item]);
+                    checkType(item, (uint8_t)columns.d[item], columns.b[item]);
+                }
+                else if (columns.kinds[item] == NODE_FUNCTION_DEF) {
+                    functions.back().blocks.back().functions.push_back(item);
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+public:
+    Resolver(FlatAstBuilder& builder, SourceBuffer_sPtr source)
+        : builder(builder), columns(builder.columns), strings(builder.strings) {
+        this->source = source;
+        functions.emplace_back();
+        pushBlock();
+    }
+
+    // Resolve the top-level statements of a program, returns its frame size
+    uint32_t program(uint32_t listRef) {
+        statements(listRef);
+        popBlock();
+        return functions[0].frameSize;
+    }
+
+    // Resolve the body of a function defined in the global scope, returns its
+    // frame size. constants are the literal constants of that scope declared
+    // before the function.
+    uint32_t body(uint32_t listRef, const std::vector<uint32_t>& argNames, const std::vector<Constant>& constants) {
+        for (const Constant& constant : constants) {
+            functions[0].blocks[0].names[constant.name] = Binding{ GLOBAL_SCOPE, true, constant.kind, constant.value, TYPE_ANY, 0, 0 };
+        }
+        functions.emplace_back();
+        pushBlock();
+        for (uint32_t argName : argNames) {
+            declare(argName, false, NO_NODE);
+        }
+        statements(listRef);
+        popBlock();
+        return functions.back().frameSize;
+    }
+};
+
+// Kind a node made by SuperinstructionFuser was made from, kind itself for
+// any other node
+inline uint8_t unfusedKind(uint8_t kind) {
+    switch (kind) {
+    case NODE_INCREMENT:
+        return NODE_VAR_ASSIGN;
+    case NODE_COMPARE_CONSTANT:
+        return NODE_BINARY_OP;
+    case NODE_UPDATE_FIELD:
+        return NODE_ATTRIBUTE_ASSIGN;
+    case NODE_PRINT:
+        return NODE_FUNCTION_CALL;
+    case NODE_COUNTED_FOR:
+        return NODE_FOR;
+    default:
+        return kind;
+    }
+}
+
+// Op of the node unfusedKind(kind) makes
+inline int16_t unfusedOp(uint8_t kind, int16_t op) {
+    switch (kind) {
+    case NODE_PRINT:
+        return 0;
+    case NODE_COUNTED_FOR:
+        return op & 1;
+    default:
+        return op;
+    }
+}
+
+// Nodes directly below node of a table. Bodies of functions and structures
+// run in another frame, they are only included if intoFunctions is set.
+inline std::vector<FlatNode> childNodes(const FlatAstColumns& columns, FlatNode node, bool intoFunctions) {
+    std::vector<FlatNode> nodes;
+    auto add = [&](FlatNode child) {
+        if (child != NO_NODE) {
+            nodes.push_back(child);
+        }
+    };
+    auto addList = [&](uint32_t listRef) {
+        for (FlatNode item : columns.list(listRef)) {
+            nodes.push_back(item);
+        }
+    };
+    uint32_t a = columns.a[node], b = columns.b[node], c = columns.c[node], d = columns.d[node];
+    switch (unfusedKind(columns.kinds[node])) {
+    case NODE_VECTOR_WRAPPER:
+    case NODE_LIST:
+        addList(a);
+        break;
+    case NODE_UNARY_OP:
+    case NODE_RETURN:
+    case NODE_CONSTRUCTOR_CALL:
+    case NODE_ATTRIBUTE_ACCESS:
+    case NODE_LOOP_INVARIANT:
+        add(a);
+        break;
+    case NODE_BINARY_OP:
+    case NODE_INDEX_ACCESS:
+    case NODE_ATTRIBUTE_ASSIGN:
+        add(a);
+        add(b);
+        break;
+    case NODE_VAR_DECLARATION:
+    case NODE_VAR_ASSIGN:
+        add(b);
+        break;
+    case NODE_IF:
+        for (uint32_t i = 0; i < columns.list(a).size(); i++) {
+            add(columns.list(a)[i]);
+            addList(columns.list(b)[i]);
+        }
+        addList(c);
+        break;
+    case NODE_FOR:
+        add(a);
+        add(b);
+        add(c);
+        addList(d);
+        break;
+    case NODE_WHILE:
+        add(a);
+        addList(b);
+        break;
+    case NODE_FUNCTION_CALL:
+        add(a);
+        addList(b);
+        break;
+    case NODE_INLINED_CALL:
+        add(a);
+        addList(b);
+        addList(d);
+        break;
+    case NODE_FUNCTION_DEF:
+        if (intoFunctions && columns.ops[node] == 0) {
+            addList(c);
+        }
+        break;
+    case NODE_STRUCT_DEF:
+        if (intoFunctions) {
+            addList(b);
+        }
+        break;
+    default:
+        break;
+    }
+    return nodes;
+}
+
+// Replaces calls of small functions in a compiled body with a copy of the
+// callee's body. Only calls of a global function declared at the top level
+// of the parent tree are candidates, and the callee's body must have at most
+// INLINE_MAX_NODES nodes and must not define functions or structures, which
+// could capture its frame.
+//
+// The copy runs in the caller's frame: the callee's slots, arguments first,
+// get a range of slots of their own after the caller's. For a call in a
+// function nested in the body, that is the frame of the nested function. A return in the copy
+// ends the INLINED_CALL node like it ends a call. The callee is still looked
+// up when the node runs, and if the name no longer refers to the function
+// the copy was made from, it is called instead.
+//
+// A callee whose body is being compiled is never inlined, so recursive
+// functions keep calling themselves and inlining always ends.
+class Inliner {
+private:
+    const FlatAst& parent;
+    FlatAstBuilder& builder;
+    FlatAstColumns& columns;
+    uint32_t frameSize;
+
+    // State of the copy being made
+    const FlatAst* callee = nullptr;
+    uint32_t base = 0;
+    uint32_t copied = 0;
+
+    uint32_t string(uint32_t index) {
+        return builder.intern(callee->string(index));
+    }
+
+    // Slot of the callee's frame in the caller's frame. Fails on names from
+    // frames further up, which the caller cannot reach.
+    bool local(uint32_t hops, uint32_t& slot) {
+        if (hops == GLOBAL_SCOPE) {
+            return true;
+        }
+        if (hops != 0) {
+            return false;
+        }
+        slot += base;
+        return true;
+    }
+
+    // List of slots of the callee's frame, moved to the caller's
+    uint32_t slots(uint32_t listRef) {
+        std::vector<uint32_t> moved;
+        for (uint32_t slot : callee->list(listRef)) {
+            moved.push_back(slot + base);
+        }
+        return builder.list(moved);
+    }
+
+    bool copyList(uint32_t listRef, uint32_t& result) {
+        std::vector<uint32_t> items;
+        for (FlatNode item : callee->list(listRef)) {
+            FlatNode copy;
+            if (!this->copy(item, copy)) {
+                return false;
+            }
+            items.push_back(copy);
+        }
+        result = builder.list(items);
+        return true;
+    }
+
+    // Append node of callee and its subtree, in pre-order like FlatAstBuilder.
+    // Returns false if it cannot be inlined, the rows added so far are left
+    // for DeadCodeEliminator.
+    bool copy(FlatNode node, FlatNode& result) {
+        result = node;
+        if (node == NO_NODE) {
+            return true;
+        }
+        if (++copied > INLINE_MAX_NODES) {
+            return false;
+        }
+
+        // Fused nodes are copied as the nodes they were made from, the
+        // caller's tree is fused once it is complete
+        uint8_t kind = unfusedKind(callee->kinds[node]);
+        FlatNode index = builder.row(kind, unfusedOp(callee->kinds[node], callee->ops[node]), callee->a[node], callee->b[node],
+            callee->c[node], callee->d[node], callee->e[node], callee->spans[node]);
+        result = index;
+
+        // The columns may reallocate while children are added, so operands
+        // are stored after their children are copied
+        uint32_t a = callee->a[node], b = callee->b[node], c = callee->c[node], d = callee->d[node], e = callee->e[node];
+        bool ok = true;
+        switch (kind) {
+        case NODE_INT:
+        case NODE_FLOAT:
+        case NODE_BREAK:
+        case NODE_CONTINUE:
+            break;
+        case NODE_STRING:
+            a = string(a);
+            break;
+        case NODE_VECTOR_WRAPPER:
+        case NODE_LIST:
+            ok = copyList(a, a);
+            break;
+        case NODE_UNARY_OP:
+        case NODE_RETURN:
+        case NODE_CONSTRUCTOR_CALL:
+            ok = copy(a, a);
+            break;
+        case NODE_ATTRIBUTE_ACCESS:
+            ok = copy(a, a);
+            b = string(b);
+            break;
+        case NODE_BINARY_OP:
+        case NODE_ATTRIBUTE_ASSIGN:
+        case NODE_INDEX_ACCESS:
+            ok = copy(a, a) && copy(b, b);
+            break;
+        case NODE_VAR_DECLARATION:
+            a = string(a);
+            ok = copy(b, b);
+            if (c != GLOBAL_SCOPE) {
+                c += base;
+            }
+            e = d != TYPE_ANY ? string(e) : e;
+            break;
+        case NODE_VAR_ASSIGN:
+            a = string(a);
+            ok = copy(b, b) && local(c, d);
+            e = callee->ops[node] != TYPE_ANY ? string(e) : e;
+            break;
+        case NODE_VAR_ACCESS:
+            a = string(a);
+            ok = local(c, d);
+            break;
+        case NODE_IF: {
+            FlatList conditions = callee->list(a);
+            FlatList bodies = callee->list(b);
+            std::vector<uint32_t> conditionNodes, bodyLists;
+            for (uint32_t i = 0; ok && i < conditions.size(); i++) {
+                FlatNode condition;
+                uint32_t body;
+                ok = copy(conditions[i], condition) && copyList(bodies[i], body);
+                conditionNodes.push_back(condition);
+                bodyLists.push_back(body);
+            }
+            ok = ok && copyList(c, c);
+            a = builder.list(conditionNodes);
+            b = builder.list(bodyLists);
+            break;
+        }
+        case NODE_FOR:
+            ok = copy(a, a) && copy(b, b) && copy(c, c) && copyList(d, d);
+            e = (callee->ops[node] & 1) != 0 ? slots(e) : e;
+            break;
+        case NODE_WHILE:
+            ok = copy(a, a) && copyList(b, b);
+            e = callee->ops[node] != 0 ? slots(e) : e;
+            break;
+        case NODE_FUNCTION_CALL:
+            ok = copy(a, a) && copyList(b, b);
+            break;
+        case NODE_INLINED_CALL:
+            ok = copy(a, a) && copyList(b, b) && copyList(d, d);
+            c += base;
+            break;
+        case NODE_LOOP_INVARIANT:
+            ok = copy(a, a);
+            c += base;
+            break;
+        default:
+            return false;
+        }
+
+        columns.a[index] = a;
+        columns.b[index] = b;
+        columns.c[index] = c;
+        columns.d[index] = d;
+        columns.e[index] = e;
+        return ok;
+    }
+
+    // Definition of the function call node calls, if it is a candidate
+    FlatNode target(FlatNode call) {
+        FlatNode calleeNode = columns.a[call];
+        if (columns.kinds[calleeNode] != NODE_VAR_ACCESS || columns.c[calleeNode] != GLOBAL_SCOPE) {
+            return NO_NODE;
+        }
+        const std::unordered_map<std::string, FlatNode>& functions = parent.topLevelFunctions();
+        auto found = functions.find(builder.strings[columns.a[calleeNode]]);
+        if (found == functions.end()) {
+            return NO_NODE;
+        }
+        FlatNode definition = found->second;
+        uint32_t argCount = columns.lists[columns.b[call]];
+        if (parent.list(parent.b[definition]).size() != argCount) {
+            return NO_NODE;
+        }
+        return definition;
+    }
+
+    void inline_(FlatNode call) {
+        FlatNode definition = target(call);
+        if (definition == NO_NODE) {
+            return;
+        }
+
+        uint32_t body, calleeFrameSize;
+        if (parent.ops[definition] != 0) {
+            // Bodies that cannot be small are not compiled ahead of their first call
+            if (parent.isCompiling(definition) || parent.d[definition] > INLINE_MAX_NODES * 16) {
+                return;
+            }
+            try {
+                callee = &parent.compileBody(definition);
+            }
+            catch (Exception e) {
+                return; // Reported when the function is called
+            }
+            body = callee->program;
+            calleeFrameSize = callee->frameSize;
+        }
+        else {
+            callee = &parent;
+            body = parent.c[definition];
+            calleeFrameSize = parent.d[definition];
+        }
+
+        base = frameSize;
+        copied = 0;
+        uint32_t statements;
+        if (!copyList(body, statements)) {
+            return;
+        }
+        frameSize += calleeFrameSize;
+        columns.kinds[call] = NODE_INLINED_CALL;
+        columns.c[call] = base;
+        columns.d[call] = statements;
+        columns.e[call] = definition;
+    }
+
+    // Copies made by inline_ are not walked again
+    void walk(FlatNode node) {
+        std::vector<FlatNode> children = childNodes(columns, node, true);
+        if (columns.kinds[node] == NODE_FUNCTION_DEF) {
+            if (columns.ops[node] != 0) {
+                return;
+            }
+            // Calls in a nested function run in its frame
+            uint32_t outerFrameSize = frameSize;
+            frameSize = columns.d[node];
+            for (FlatNode child : children) {
+                walk(child);
+            }
+            columns.d[node] = frameSize;
+            frameSize = outerFrameSize;
+            return;
+        }
+        if (columns.kinds[node] == NODE_FUNCTION_CALL) {
+            inline_(node);
+        }
+        for (FlatNode child : children) {
+            walk(child);
+        }
+    }
+
+public:
+    Inliner(const FlatAst& parent, FlatAstBuilder& builder, uint32_t frameSize)
+        : parent(parent), builder(builder), columns(builder.columns) {
+        this->frameSize = frameSize;
+    }
+
+    // Inline the candidates among the calls in the statements of listRef,
+    // returns the new frame size of the body
+    uint32_t run(uint32_t listRef) {
+        std::vector<uint32_t> statements(&columns.lists[listRef + 1], &columns.lists[listRef + 1] + columns.lists[listRef]);
+        for (FlatNode statement : statements) {
+            walk(statement);
+        }
+        return frameSize;
+    }
+};
+
+// Replaces calls of pure functions whose arguments are all literals with the
+// value the call returns, worked out once while the tree is built. Only
+// calls of a global function declared at the top level of the definitions
+// tree are candidates, see FlatAst::isPure and FlatAst::evaluateCall.
+//
+// The name of the callee may refer to another function by the time the call
+// runs, so the call is not replaced by the bare literal. It becomes an
+// INLINED_CALL whose body returns the literal, with the same guard as a call
+// the Inliner copied. The arguments of all folded calls in a frame share one
+// range of slots.
+class ConstantCallFolder {
+private:
+    struct Fold {
+        FlatNode call;
+        FlatNode function; // FUNCTION_DEF whose frame the call runs in, or NO_NODE
+        FlatNode definition;
+        LiteralValue value;
+    };
+
+    const FlatAst& definitions;
+    FlatAstBuilder& builder;
+    FlatAstColumns& columns;
+    uint32_t frameSize;
+    std::vector<Fold> folds;
+
+    bool literal(FlatNode node, LiteralValue& value) {
+        value.kind = columns.kinds[node];
+        value.value = columns.a[node];
+        if (value.kind == NODE_STRING) {
+            value.text = builder.strings[columns.a[node]];
+            return true;
+        }
+        return value.kind == NODE_INT || value.kind == NODE_FLOAT;
+    }
+
+    // Definition a call with literal arguments calls, if it is a candidate
+    FlatNode target(FlatNode call, std::vector<LiteralValue>& args) {
+        for (FlatNode arg : columns.list(columns.b[call])) {
+            LiteralValue value;
+            if (!literal(arg, value)) {
+                return NO_NODE;
+            }
+            args.push_back(value);
+        }
+        if (columns.kinds[call] == NODE_INLINED_CALL) {
+            return columns.e[call];
+        }
+
+        FlatNode calleeNode = columns.a[call];
+        if (columns.kinds[calleeNode] != NODE_VAR_ACCESS || columns.c[calleeNode] != GLOBAL_SCOPE) {
+            return NO_NODE;
+        }
+        const std::unordered_map<std::string, FlatNode>& functions = definitions.topLevelFunctions();
+        auto found = functions.find(builder.strings[columns.a[calleeNode]]);
+        if (found == functions.end() || definitions.list(definitions.b[found->second]).size() != args.size()) {
+            return NO_NODE;
+        }
+        return found->second;
+    }
+
+    void walk(FlatNode node, FlatNode function) {
+        uint8_t kind = columns.kinds[node];
+        if (kind == NODE_FUNCTION_DEF) {
+            if (columns.ops[node] != 0) {
+                return;
+            }
+            function = node;
+        }
+        else if (kind == NODE_FUNCTION_CALL || kind == NODE_INLINED_CALL) {
+            std::vector<LiteralValue> args;
+            FlatNode definition = target(node, args);
+            LiteralValue value;
+            if (definition != NO_NODE && definitions.evaluateCall(definition, args, value)) {
+                folds.push_back(Fold{ node, function, definition, value });
+                return;
+            }
+        }
+        for (FlatNode child : childNodes(columns, node, true)) {
+            walk(child, function);
+        }
+    }
+
+    // Rows are only added once every call is evaluated, as the definitions
+    // may be a view of the same columns
+    void apply() {
+        std::unordered_map<FlatNode, uint32_t> argSlots; // By frame
+        for (const Fold& fold : folds) {
+            uint32_t& size = fold.function != NO_NODE ? columns.d[fold.function] : frameSize;
+            auto inserted = argSlots.emplace(fold.function, size);
+            uint32_t argCount = columns.lists[columns.b[fold.call]];
+            size = std::max(size, inserted.first->second + argCount);
+        }
+
+        for (const Fold& fold : folds) {
+            Span span = columns.spans[fold.call];
+            uint32_t value = fold.value.kind == NODE_STRING ? builder.intern(fold.value.text) : fold.value.value;
+            FlatNode ret = builder.row(NODE_RETURN, 0, (FlatNode)columns.kinds.size() + 1, 0, 0, 0, 0, span);
+            builder.row(fold.value.kind, 0, value, 0, 0, 0, 0, span);
+            std::vector<uint32_t> body = { ret };
+
+            columns.kinds[fold.call] = NODE_INLINED_CALL;
+            columns.c[fold.call] = argSlots[fold.function];
+            columns.d[fold.call] = builder.list(body);
+            columns.e[fold.call] = fold.definition;
+        }
+    }
+
+public:
+    ConstantCallFolder(const FlatAst& definitions, FlatAstBuilder& builder, uint32_t frameSize)
+        : definitions(definitions), builder(builder), columns(builder.columns) {
+        this->frameSize = frameSize;
+    }
+
+    // Fold the candidates among the calls in the statements of listRef,
+    // returns the new frame size of the statements
+    uint32_t run(uint32_t listRef) {
+        std::vector<uint32_t> statements(&columns.lists[listRef + 1], &columns.lists[listRef + 1] + columns.lists[listRef]);
+        for (FlatNode statement : statements) {
+            walk(statement, NO_NODE);
+        }
+        apply();
+        return frameSize;
+    }
+};
+
+// Replaces structure instances and list literals that never leave the frame
+// they are made in with a local variable per field or item. Candidates are
+// local variables declared as
+//   - new S, for a structure S declared at the top level of the definitions
+//     tree with at least one field, and
+//   - a list literal.
+// The variable may only be used as v.f and v.f = value for fields f of S,
+// or as v[i] for an INT i within the list and as len(v). Any other use, an
+// annotation or a reference from a nested function leaves it alone.
+//
+// The declaration becomes a block declaring the new locals. A field starts
+// with the value of the field of S when the declaration runs, as
+// StructureDefinition::createInstance gives it, and keeps its annotation.
+class ScalarReplacement {
+private:
+    struct Candidate {
+        FlatNode declaration;
+        FlatNode function; // FUNCTION_DEF whose frame the variable is in, or NO_NODE
+        FlatNode structure; // STRUCT_DEF in definitions, NO_NODE for a list
+        bool escapes = false;
+        std::vector<FlatNode> uses;
+    };
+
+    const FlatAst& definitions;
+    FlatAstBuilder& builder;
+    FlatAstColumns& columns;
+    uint32_t frameSize;
+    std::unordered_map<uint64_t, Candidate> candidates; // By function << 32 | slot
+    std::unordered_set<uint32_t> capturedSlots; // Read or assigned from a nested function
+    ScalarReplacementStats stats;
+
+    static uint64_t key(FlatNode function, uint32_t slot) {
+        return (uint64_t)function << 32 | slot;
+    }
+
+    Candidate* candidate(FlatNode node, FlatNode function) {
+        if (columns.kinds[node] != NODE_VAR_ACCESS || columns.c[node] != 0) {
+            return nullptr;
+        }
+        auto found = candidates.find(key(function, columns.d[node]));
+        return found != candidates.end() ? &found->second : nullptr;
+    }
+
+    // STRUCT_DEF of the top level of definitions that node constructs
+    FlatNode structure(FlatNode node) {
+        FlatNode structureNode = columns.a[node];
+        if (columns.kinds[structureNode] != NODE_VAR_ACCESS || columns.c[structureNode] != GLOBAL_SCOPE) {
+            return NO_NODE;
+        }
+        const std::unordered_map<std::string, FlatNode>& structures = definitions.topLevelStructures();
+        auto found = structures.find(builder.strings[columns.a[structureNode]]);
+        return found != structures.end() ? found->second : NO_NODE;
+    }
+
+    // Field declaration of the structure named name, or NO_NODE
+    FlatNode field(FlatNode structure, uint32_t name) {
+        for (FlatNode member : definitions.list(definitions.b[structure])) {
+            if (definitions.kinds[member] == NODE_VAR_DECLARATION && definitions.string(definitions.a[member]) == builder.strings[name]) {
+                return member;
+            }
+        }
+        return NO_NODE;
+    }
+
+    void declaration(FlatNode node, FlatNode function) {
+        if (columns.c[node] == GLOBAL_SCOPE || columns.d[node] != TYPE_ANY) {
+            return;
+        }
+        FlatNode value = columns.b[node];
+        FlatNode structureNode = NO_NODE;
+        if (columns.kinds[value] == NODE_CONSTRUCTOR_CALL) {
+            structureNode = structure(value);
+            if (structureNode == NO_NODE) {
+                return;
+            }
+            bool hasFields = false;
+            for (FlatNode member : definitions.list(definitions.b[structureNode])) {
+                hasFields = hasFields || definitions.kinds[member] == NODE_VAR_DECLARATION;
+            }
+            if (!hasFields) {
+                return;
+            }
+        }
+        else if (columns.kinds[value] != NODE_LIST) {
+            return;
+        }
+        Candidate found;
+        found.declaration = node;
+        found.function = function;
+        found.structure = structureNode;
+        candidates.emplace(key(function, columns.c[node]), found);
+    }
+
+    // Candidate node uses in a way it can be replaced in, or null. The use
+    // is recorded, it marks the candidate as escaping if it is not one the
+    // candidate can do without.
+    Candidate* use(FlatNode node, FlatNode function) {
+        Candidate* used = nullptr;
+        switch (columns.kinds[node]) {
+        case NODE_ATTRIBUTE_ACCESS:
+            used = candidate(columns.a[node], function);
+            if (used != nullptr && (used->structure == NO_NODE || field(used->structure, columns.b[node]) == NO_NODE)) {
+                used->escapes = true;
+            }
+            break;
+        case NODE_INDEX_ACCESS: {
+            used = candidate(columns.a[node], function);
+            FlatNode index = columns.b[node];
+            if (used != nullptr && (used->structure != NO_NODE || columns.kinds[index] != NODE_INT ||
+                columns.a[index] >= columns.lists[columns.a[columns.b[used->declaration]]])) {
+                used->escapes = true;
+            }
+            break;
+        }
+        case NODE_FUNCTION_CALL: {
+            FlatNode callee = columns.a[node];
+            uint32_t args = columns.b[node];
+            if (columns.kinds[callee] == NODE_VAR_ACCESS && columns.c[callee] == GLOBAL_SCOPE && columns.lists[args] == 1 &&
+                builder.strings[columns.a[callee]] == "len") {
+                used = candidate(columns.lists[args + 1], function);
+            }
+            if (used != nullptr && used->structure != NO_NODE) {
+                used->escapes = true;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        if (used != nullptr) {
+            used->uses.push_back(node);
+        }
+        return used;
+    }
+
+    void walk(FlatNode node, FlatNode function) {
+        switch (columns.kinds[node]) {
+        case NODE_FUNCTION_DEF:
+            if (columns.ops[node] != 0) {
+                return;
+            }
+            function = node;
+            break;
+        case NODE_VAR_DECLARATION:
+            declaration(node, function);
+            break;
+        case NODE_VAR_ACCESS:
+        case NODE_VAR_ASSIGN:
+            if (columns.c[node] == 0) {
+                auto found = candidates.find(key(function, columns.d[node]));
+                if (found != candidates.end()) {
+                    found->second.escapes = true;
+                }
+            }
+            else if (columns.c[node] != GLOBAL_SCOPE) {
+                capturedSlots.insert(columns.d[node]);
+            }
+            break;
+        case NODE_ATTRIBUTE_ASSIGN: {
+            Candidate* used = use(columns.a[node], function);
+            if (used != nullptr) {
+                used->uses.back() = node;
+                walk(columns.b[node], function);
+                return;
+            }
+            break;
+        }
+        default: {
+            // Indexes are the only part of a use that is not the candidate
+            if (use(node, function) != nullptr) {
+                if (columns.kinds[node] == NODE_INDEX_ACCESS) {
+                    walk(columns.b[node], function);
+                }
+                return;
+            }
+            break;
+        }
+        }
+        for (FlatNode child : childNodes(columns, node, true)) {
+            walk(child, function);
+        }
+    }
+
+    uint32_t newSlot(FlatNode function) {
+        if (function == NO_NODE) {
+            return frameSize++;
+        }
+        return columns.d[function]++;
+    }
+
+    // Local of a field: slot, name, type and annotation
+    struct Local {
+        uint32_t slot, name, type, annotation;
+    };
+
+    void replace(Candidate& replaced) {
+        FlatNode node = replaced.declaration;
+        Span span = columns.spans[node];
+        std::vector<uint32_t> declarations;
+        std::unordered_map<uint32_t, Local> fields; // By name
+        std::vector<Local> items;
+
+        if (replaced.structure != NO_NODE) {
+            FlatNode structureNode = columns.a[columns.b[node]];
+            for (FlatNode member : definitions.list(definitions.b[replaced.structure])) {
+                if (definitions.kinds[member] != NODE_VAR_DECLARATION) {
+                    continue;
+                }
+                Local local;
+                local.slot = newSlot(replaced.function);
+                local.name = builder.intern(definitions.string(definitions.a[member]));
+                local.type = definitions.d[member];
+                local.annotation = local.type != TYPE_ANY ? builder.intern(definitions.string(definitions.e[member])) : 0;
+                if (!fields.emplace(local.name, local).second) {
+                    continue;
+                }
+
+                // S.f, the value an instance starts with
+                FlatNode declared = builder.row(NODE_VAR_DECLARATION, 0, local.name, 0, local.slot, local.type, local.annotation, span);
+                FlatNode structureAccess = builder.row(NODE_VAR_ACCESS, 0, columns.a[structureNode], 0, GLOBAL_SCOPE, GLOBAL_SCOPE, 0, span);
+                FlatNode initial = builder.row(NODE_ATTRIBUTE_ACCESS, 0, structureAccess, local.name, 0, 0, 0, span);
+                columns.b[declared] = initial;
+                declarations.push_back(declared);
+                stats.fields++;
+            }
+            stats.instances++;
+        }
+        else {
+            uint32_t itemList = columns.a[columns.b[node]];
+            std::vector<uint32_t> itemNodes(&columns.lists[itemList + 1], &columns.lists[itemList + 1] + columns.lists[itemList]);
+            for (FlatNode item : itemNodes) {
+                Local local{ newSlot(replaced.function), columns.a[node], TYPE_ANY, 0 };
+                FlatNode declared = builder.row(NODE_VAR_DECLARATION, 0, local.name, item, local.slot, 0, 0, span);
+                declarations.push_back(declared);
+                items.push_back(local);
+                stats.fields++;
+            }
+            stats.lists++;
+        }
+
+        uint32_t block = builder.list(declarations);
+        columns.kinds[node] = NODE_VECTOR_WRAPPER;
+        columns.ops[node] = 0;
+        columns.a[node] = block;
+        columns.b[node] = 0;
+        columns.c[node] = 0;
+        columns.d[node] = 0;
+        columns.e[node] = 0;
+
+        for (FlatNode use : replaced.uses) {
+            uint8_t kind = columns.kinds[use];
+            if (kind == NODE_FUNCTION_CALL) {
+                columns.kinds[use] = NODE_INT;
+                columns.a[use] = (uint32_t)items.size();
+                columns.b[use] = 0;
+                continue;
+            }
+            if (kind == NODE_ATTRIBUTE_ASSIGN) {
+                const Local& local = fields.at(columns.b[columns.a[use]]);
+                columns.kinds[use] = NODE_VAR_ASSIGN;
+                columns.ops[use] = (int16_t)local.type;
+                columns.a[use] = local.name;
+                columns.c[use] = 0;
+                columns.d[use] = local.slot;
+                columns.e[use] = local.annotation;
+                continue;
+            }
+            const Local& local = kind == NODE_INDEX_ACCESS ? items[columns.a[columns.b[use]]] : fields.at(columns.b[use]);
+            columns.kinds[use] = NODE_VAR_ACCESS;
+            columns.ops[use] = (int16_t)local.type;
+            columns.a[use] = local.name;
+            columns.b[use] = 0;
+            columns.c[use] = 0;
+            columns.d[use] = local.slot;
+        }
+    }
+
+public:
+    ScalarReplacement(const FlatAst& definitions, FlatAstBuilder& builder, uint32_t frameSize)
+        : definitions(definitions), builder(builder), columns(builder.columns) {
+        this->frameSize = frameSize;
+    }
+
+    // Replace the candidates in the statements of listRef, returns the new
+    // frame size of the statements
+    uint32_t run(uint32_t listRef) {
+        std::vector<uint32_t> statements(&columns.lists[listRef + 1], &columns.lists[listRef + 1] + columns.lists[listRef]);
+        for (FlatNode statement : statements) {
+            walk(statement, NO_NODE);
+        }
+        for (auto& entry : candidates) {
+            Candidate& found = entry.second;
+            if (!found.escapes && capturedSlots.find(columns.c[found.declaration]) == capturedSlots.end()) {
+                replace(found);
+            }
+        }
+        return frameSize;
+    }
+
+    const ScalarReplacementStats& statistics() const {
+        return stats;
+    }
+};
+
+// Copies a resolved tree without the code that can never run or has no
+// effect, so those rows no longer take up space in the table:
+//   - if cases whose condition is known to be false, and everything after
+//     a case that is known to be true
+//   - while and for loops whose condition is known to be false
+//   - statements after a return, break or continue in the same list
+//   - expression statements whose value is known and unused
+// A condition is known if it is made of literals, true and false and
+// operations on them that cannot fail. Folding in the Resolver turns most
+// constant expressions into literals first.
+//
+// Declarations at the top level are never removed, they tell the
+// interpreter which globals exist. For the same reason bodies of known if
+// cases are only moved into the enclosing list below the top level.
+class DeadCodeEliminator {
+private:
+    const FlatAstColumns& in;
+    FlatAstBuilder out;
+    const std::vector<std::string>& strings; // Of out, new strings are not needed
+    DeadCodeStats stats;
+
+    bool isNumber(FlatNode node) {
+        return in.kinds[node] == NODE_INT || in.kinds[node] == NODE_FLOAT;
+    }
+
+    bool isGlobal(FlatNode node, const char* name) {
+        return in.kinds[node] == NODE_VAR_ACCESS && in.c[node] == GLOBAL_SCOPE && strings[in.a[node]] == name;
+    }
+
+    bool compare(int16_t op, int order) {
+        switch (op) {
+        case OP_LT: return order < 0;
+        case OP_GT: return order > 0;
+        case OP_LTE: return order <= 0;
+        case OP_GTE: return order >= 0;
+        case OP_EE: return order == 0;
+        default: return order != 0;
+        }
+    }
+
+    // Whether node always evaluates to the same truth value without side
+    // effects or errors. boolean tells if that value is a Boolean, the only
+    // type that supports and and or.
+    bool known(FlatNode node, bool& truth, bool& boolean) {
+        boolean = false;
+        switch (in.kinds[node]) {
+        case NODE_INT:
+        case NODE_FLOAT:
+            truth = in.floatOf(node) != 0;
+            return true;
+        case NODE_STRING:
+            truth = !strings[in.a[node]].empty();
+            return true;
+        case NODE_VAR_ACCESS:
+            // The predefined constants cannot be declared again
+            boolean = true;
+            truth = isGlobal(node, "true");
+            return truth || isGlobal(node, "false");
+        case NODE_UNARY_OP: {
+            bool operand, operandBoolean;
+            if (in.ops[node] != OP_NOT || !known(in.a[node], operand, operandBoolean)) {
+                return false;
+            }
+            boolean = true;
+            truth = !operand;
+            return true;
+        }
+        case NODE_BINARY_OP: {
+            FlatNode left = in.a[node], right = in.b[node];
+            int16_t op = in.ops[node];
+            if (op == OP_AND || op == OP_OR) {
+                bool l, r, leftBoolean, rightBoolean;
+                if (!known(left, l, leftBoolean) || !leftBoolean || !known(right, r, rightBoolean)) {
+                    return false;
+                }
+                boolean = true;
+                truth = op == OP_AND ? l && r : l || r;
+                return true;
+            }
+            if (op < OP_LT || op > OP_NE) {
+                return false;
+            }
+            if (isNumber(left) && isNumber(right)) {
+                float l = in.floatOf(left), r = in.floatOf(right);
+                // NaN compares false with everything but !=
+                truth = op == OP_NE ? l != r : compare(op, l < r ? -1 : l > r ? 1 : 0) && l == l && r == r;
+            }
+            else if (in.kinds[left] == NODE_STRING && in.kinds[right] == NODE_STRING) {
+                truth = compare(op, strings[in.a[left]].compare(strings[in.a[right]]));
+            }
+            else {
+                return false;
+            }
+            boolean = true;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    bool known(FlatNode node, bool& truth) {
+        bool boolean;
+        return known(node, truth, boolean);
+    }
+
+    bool hasNoEffect(FlatNode node) {
+        bool truth;
+        if (in.kinds[node] == NODE_LIST) {
+            for (FlatNode item : in.list(in.a[node])) {
+                if (!hasNoEffect(item)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return known(node, truth);
+    }
+
+    bool isDeclaration(FlatNode node) {
+        uint8_t kind = in.kinds[node];
+        return kind == NODE_VAR_DECLARATION || kind == NODE_FUNCTION_DEF || kind == NODE_STRUCT_DEF;
+    }
+
+    // Whether the copied statement ends the list it is in
+    bool terminates(FlatNode node) {
+        switch (out.columns.kinds[node]) {
+        case NODE_RETURN:
+        case NODE_BREAK:
+        case NODE_CONTINUE:
+            return true;
+        case NODE_IF: {
+            const std::vector<uint32_t>& lists = out.columns.lists;
+            uint32_t bodies = out.columns.b[node];
+            for (uint32_t i = 0; i < lists[bodies]; i++) {
+                uint32_t body = lists[bodies + 1 + i];
+                if (lists[body] == 0 || !terminates(lists[body + lists[body]])) {
+                    return false;
+                }
+            }
+            uint32_t elseBody = out.columns.c[node];
+            return lists[elseBody] != 0 && terminates(lists[elseBody + lists[elseBody]]);
+        }
+        default:
+            return false;
+        }
+    }
+
+    // Append a row for node with its operands, children are filled in by the caller
+    FlatNode row(FlatNode node) {
+        return out.copyRow(in, node);
+    }
+
+    uint32_t copyList(uint32_t listRef) {
+        std::vector<uint32_t> copied(in.list(listRef).begin(), in.list(listRef).end());
+        return out.list(copied);
+    }
+
+    uint32_t nodeList(uint32_t listRef) {
+        std::vector<uint32_t> copied;
+        for (FlatNode item : in.list(listRef)) {
+            copied.push_back(copy(item));
+        }
+        return out.list(copied);
+    }
+
+    uint32_t statements(uint32_t listRef, bool topLevel = false) {
+        std::vector<uint32_t> copied;
+        bool terminated = false;
+        statements(listRef, topLevel, copied, terminated);
+        return out.list(copied);
+    }
+
+    void statements(uint32_t listRef, bool topLevel, std::vector<uint32_t>& copied, bool& terminated) {
+        for (FlatNode node : in.list(listRef)) {
+            if (terminated && !(topLevel && isDeclaration(node))) {
+                stats.statements++;
+                continue;
+            }
+            if (hasNoEffect(node)) {
+                stats.expressions++;
+                continue;
+            }
+
+            bool truth;
+            switch (in.kinds[node]) {
+            case NODE_IF:
+                if (!topLevel) {
+                    uint32_t body = knownCase(node);
+                    if (body != NO_NODE) {
+                        statements(body, topLevel, copied, terminated);
+                        continue;
+                    }
+                }
+                break;
+            case NODE_WHILE:
+                if (known(in.a[node], truth) && !truth) {
+                    stats.branches++;
+                    continue;
+                }
+                break;
+            case NODE_FOR:
+                // The initialization still runs once
+                if (!topLevel && known(in.b[node], truth) && !truth) {
+                    stats.branches++;
+                    if (in.a[node] != NO_NODE) {
+                        copied.push_back(copy(in.a[node]));
+                    }
+                    continue;
+                }
+                break;
+            default:
+                break;
+            }
+
+            FlatNode statement = copy(node);
+            if (statement != NO_NODE) {
+                copied.push_back(statement);
+                terminated = terminates(statement);
+            }
+        }
+    }
+
+    // Statements of the if node that always run, if they are known
+    uint32_t knownCase(FlatNode node) {
+        FlatList conditions = in.list(in.a[node]);
+        FlatList bodies = in.list(in.b[node]);
+        for (uint32_t i = 0; i < conditions.size(); i++) {
+            bool truth;
+            if (!known(conditions[i], truth)) {
+                return NO_NODE;
+            }
+            if (truth) {
+                stats.branches += conditions.size() - i;
+                return bodies[i];
+            }
+        }
+        stats.branches += conditions.size();
+        return in.c[node];
+    }
+
+    FlatNode copyIf(FlatNode node) {
+        FlatList conditions = in.list(in.a[node]);
+        FlatList bodies = in.list(in.b[node]);
+        std::vector<uint32_t> keptConditions, keptBodies;
+        std::vector<uint32_t> conditionNodes, bodyLists;
+        uint32_t elseBody = in.c[node];
+        for (uint32_t i = 0; i < conditions.size(); i++) {
+            bool truth;
+            if (known(conditions[i], truth)) {
+                if (!truth) {
+                    stats.branches++;
+                    continue;
+                }
+                // Later cases are never tried, this one becomes the else
+                stats.branches += conditions.size() - i;
+                elseBody = bodies[i];
+                break;
+            }
+            keptConditions.push_back(conditions[i]);
+            keptBodies.push_back(bodies[i]);
+        }
+        if (keptConditions.empty() && in.list(elseBody).size() == 0) {
+            return NO_NODE;
+        }
+
+        FlatNode index = row(node);
+        for (uint32_t i = 0; i < keptConditions.size(); i++) {
+            conditionNodes.push_back(copy(keptConditions[i]));
+            bodyLists.push_back(statements(keptBodies[i]));
+        }
+        uint32_t elseList = statements(elseBody);
+        out.columns.a[index] = out.list(conditionNodes);
+        out.columns.b[index] = out.list(bodyLists);
+        out.columns.c[index] = elseList;
+        return index;
+    }
+
+    FlatNode copy(FlatNode node) {
+        if (node == NO_NODE) {
+            return NO_NODE;
+        }
+        if (in.kinds[node] == NODE_IF) {
+            return copyIf(node);
+        }
+
+        // Children are copied in the order FlatAstBuilder adds them
+        FlatNode index = row(node);
+        std::vector<uint32_t>& a = out.columns.a;
+        std::vector<uint32_t>& b = out.columns.b;
+        std::vector<uint32_t>& c = out.columns.c;
+        std::vector<uint32_t>& d = out.columns.d;
+        switch (in.kinds[node]) {
+        case NODE_VECTOR_WRAPPER:
+        case NODE_LIST: {
+            uint32_t list = nodeList(in.a[node]);
+            a[index] = list;
+            break;
+        }
+        case NODE_UNARY_OP:
+        case NODE_RETURN:
+        case NODE_CONSTRUCTOR_CALL:
+        case NODE_ATTRIBUTE_ACCESS: {
+            FlatNode operand = copy(in.a[node]);
+            a[index] = operand;
+            break;
+        }
+        case NODE_BINARY_OP:
+        case NODE_ATTRIBUTE_ASSIGN:
+        case NODE_INDEX_ACCESS: {
+            FlatNode left = copy(in.a[node]);
+            FlatNode right = copy(in.b[node]);
+            a[index] = left;
+            b[index] = right;
+            break;
+        }
+        case NODE_VAR_DECLARATION:
+        case NODE_VAR_ASSIGN: {
+            FlatNode value = copy(in.b[node]);
+            b[index] = value;
+            break;
+        }
+        case NODE_FOR: {
+            FlatNode init = copy(in.a[node]);
+            FlatNode condition = copy(in.b[node]);
+            FlatNode update = copy(in.c[node]);
+            uint32_t body = statements(in.d[node]);
+            a[index] = init;
+            b[index] = condition;
+            c[index] = update;
+            d[index] = body;
+            if (in.ops[node] != 0) {
+                uint32_t slots = copyList(in.e[node]);
+                out.columns.e[index] = slots;
+            }
+            break;
+        }
+        case NODE_WHILE: {
+            FlatNode condition = copy(in.a[node]);
+            uint32_t body = statements(in.b[node]);
+            a[index] = condition;
+            b[index] = body;
+            if (in.ops[node] != 0) {
+                uint32_t slots = copyList(in.e[node]);
+                out.columns.e[index] = slots;
+            }
+            break;
+        }
+        case NODE_LOOP_INVARIANT: {
+            FlatNode expression = copy(in.a[node]);
+            a[index] = expression;
+            break;
+        }
+        case NODE_FUNCTION_DEF: {
+            uint32_t argNames = copyList(in.b[node]);
+            b[index] = argNames;
+            if (in.ops[node] == 0) {
+                uint32_t body = statements(in.c[node]);
+                c[index] = body;
+            }
+            break;
+        }
+        case NODE_FUNCTION_CALL: {
+            FlatNode callee = copy(in.a[node]);
+            uint32_t arguments = nodeList(in.b[node]);
+            a[index] = callee;
+            b[index] = arguments;
+            break;
+        }
+        case NODE_INLINED_CALL: {
+            FlatNode callee = copy(in.a[node]);
+            uint32_t arguments = nodeList(in.b[node]);
+            uint32_t body = statements(in.d[node]);
+            a[index] = callee;
+            b[index] = arguments;
+            d[index] = body;
+            break;
+        }
+        case NODE_STRUCT_DEF: {
+            uint32_t body = nodeList(in.b[node]);
+            b[index] = body;
+            break;
+        }
+        default:
+            break;
+        }
+        return index;
+    }
+
+public:
+    DeadCodeEliminator(FlatAstBuilder& builder) : in(builder.columns), strings(out.strings) {
+        out.strings = std::move(builder.strings);
+        out.stringIndex = std::move(builder.stringIndex);
+    }
+
+    // Copy the statements of listRef into the result, returns the new list
+    uint32_t program(uint32_t listRef, bool topLevel) {
+        stats.nodesBefore = (uint32_t)in.kinds.size();
+        uint32_t program = statements(listRef, topLevel);
+        stats.nodesAfter = (uint32_t)out.columns.kinds.size();
+        return program;
+    }
+
+    FlatAstBuilder& result() {
+        return out;
+    }
+
+    const DeadCodeStats& statistics() const {
+        return stats;
+    }
+};
+
+// Evaluates expressions that do not change while a loop runs once per run
+// of the loop instead of once per iteration. Such an expression is replaced
+// by a LOOP_INVARIANT node, which keeps its value in a slot of its own the
+// first time it is evaluated and returns that value afterwards. Loops clear
+// the slots of their invariants when they start. The expression is still
+// evaluated where it was, so a loop that does not reach it never evaluates
+// it and errors happen at the same point as before.
+//
+// An expression is invariant if the loop does not assign the variables it
+// reads and cannot change the objects it looks into. Calls of functions
+// other than pureFunctions() may change any object and global, and also
+// locals if a closure assigns names of its enclosing functions. The + and -
+// operators change lists in place, so they are only moved if their left
+// operand cannot be a list. Arithmetic and comparisons fail on lists and
+// structures, so their results never depend on what an object contains.
+class LoopInvariantMotion {
+private:
+    struct Effects {
+        std::unordered_set<uint32_t> slots;   // Locals of the frame assigned
+        std::unordered_set<uint32_t> globals; // Names of globals assigned
+        bool calls = false;                   // Calls that may do anything
+        bool objects = false;                 // May change lists or structures
+    };
+
+    FlatAstBuilder& builder;
+    FlatAstColumns& columns;
+    uint32_t programFrameSize;
+
+    // Function whose frame the code being walked runs in, NO_NODE for the tree itself
+    FlatNode function = NO_NODE;
+    bool localsEscape = false;
+
+    std::vector<FlatNode> children(FlatNode node, bool intoFunctions) {
+        return childNodes(columns, node, intoFunctions);
+    }
+
+    bool isPureCall(FlatNode node) {
+        FlatNode callee = columns.a[node];
+        return columns.kinds[callee] == NODE_VAR_ACCESS && columns.c[callee] == GLOBAL_SCOPE &&
+            pureFunctions().count(builder.strings[columns.a[callee]]) != 0;
+    }
+
+    bool mayBeObject(FlatNode node) {
+        switch (columns.kinds[node]) {
+        case NODE_INT:
+        case NODE_FLOAT:
+        case NODE_STRING:
+        case NODE_UNARY_OP:
+        case NODE_BINARY_OP:
+            return false;
+        case NODE_LOOP_INVARIANT:
+            return mayBeObject(columns.a[node]);
+        default:
+            return true;
+        }
+    }
+
+    // Whether a function defined in body assigns a name of a frame above its own
+    bool assignsOuter(FlatNode node, bool inFunction) {
+        uint8_t kind = columns.kinds[node];
+        if (inFunction && kind == NODE_VAR_ASSIGN && columns.c[node] != 0 && columns.c[node] != GLOBAL_SCOPE) {
+            return true;
+        }
+        inFunction = inFunction || kind == NODE_FUNCTION_DEF;
+        for (FlatNode child : children(node, true)) {
+            if (assignsOuter(child, inFunction)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void effects(FlatNode node, Effects& effects) {
+        switch (columns.kinds[node]) {
+        case NODE_VAR_DECLARATION:
+            if (columns.c[node] == GLOBAL_SCOPE) {
+                effects.globals.insert(columns.a[node]);
+            }
+            else {
+                effects.slots.insert(columns.c[node]);
+            }
+            break;
+        case NODE_VAR_ASSIGN:
+            if (columns.c[node] == GLOBAL_SCOPE) {
+                effects.globals.insert(columns.a[node]);
+            }
+            else if (columns.c[node] == 0) {
+                effects.slots.insert(columns.d[node]);
+            }
+            break;
+        case NODE_FUNCTION_DEF:
+            if (columns.e[node] == GLOBAL_SCOPE) {
+                effects.globals.insert(columns.a[node]);
+            }
+            else {
+                effects.slots.insert(columns.e[node]);
+            }
+            break;
+        case NODE_STRUCT_DEF:
+            if (columns.c[node] == GLOBAL_SCOPE) {
+                effects.globals.insert(columns.a[node]);
+            }
+            else {
+                effects.slots.insert(columns.c[node]);
+            }
+            effects.calls = true;
+            break;
+        case NODE_FUNCTION_CALL:
+            effects.calls = effects.calls || !isPureCall(node);
+            break;
+        case NODE_INLINED_CALL:
+            // The arguments are stored without an assignment node
+            for (uint32_t i = 0; i < columns.list(columns.b[node]).size(); i++) {
+                effects.slots.insert(columns.c[node] + i);
+            }
+            effects.calls = true;
+            break;
+        case NODE_CONSTRUCTOR_CALL:
+        case NODE_IMPORT:
+            effects.calls = true;
+            break;
+        case NODE_ATTRIBUTE_ASSIGN:
+            effects.objects = true;
+            break;
+        case NODE_BINARY_OP:
+            if ((columns.ops[node] == OP_ADD || columns.ops[node] == OP_SUB) && mayBeObject(columns.a[node])) {
+                effects.objects = true;
+            }
+            break;
+        default:
+            break;
+        }
+        for (FlatNode child : children(node, false)) {
+            this->effects(child, effects);
+        }
+    }
+
+    bool invariant(FlatNode node, const Effects& effects) {
+        FlatNode a = columns.a[node], b = columns.b[node];
+        bool objects = effects.objects || effects.calls;
+        switch (columns.kinds[node]) {
+        case NODE_INT:
+        case NODE_FLOAT:
+        case NODE_STRING:
+            return true;
+        case NODE_VAR_ACCESS:
+            if (columns.c[node] == GLOBAL_SCOPE) {
+                return !effects.calls && effects.globals.count(a) == 0;
+            }
+            return columns.c[node] == 0 && effects.slots.count(columns.d[node]) == 0 && !(effects.calls && localsEscape);
+        case NODE_UNARY_OP:
+            if (columns.ops[node] == OP_NOT && objects && mayBeObject(a)) {
+                return false;
+            }
+            return invariant(a, effects);
+        case NODE_BINARY_OP: {
+            int16_t op = columns.ops[node];
+            if ((op == OP_ADD || op == OP_SUB) && mayBeObject(a)) {
+                return false;
+            }
+            // Only these read the contents of an object, through toString
+            // or is_true. The other operators fail on lists and structures.
+            bool readsObjects = op == OP_ADD || op == OP_SUB || op == OP_AND || op == OP_OR;
+            if (objects && readsObjects && (mayBeObject(a) || mayBeObject(b))) {
+                return false;
+            }
+            return invariant(a, effects) && invariant(b, effects);
+        }
+        case NODE_FUNCTION_CALL:
+            if (!isPureCall(node)) {
+                return false;
+            }
+            for (FlatNode argument : columns.list(b)) {
+                if ((objects && mayBeObject(argument)) || !invariant(argument, effects)) {
+                    return false;
+                }
+            }
+            return true;
+        case NODE_ATTRIBUTE_ACCESS:
+            return !objects && invariant(a, effects);
+        case NODE_INDEX_ACCESS:
+            return !objects && invariant(a, effects) && invariant(b, effects);
+        default:
+            return false;
+        }
+    }
+
+    uint32_t newSlot() {
+        if (function == NO_NODE) {
+            return programFrameSize++;
+        }
+        return columns.d[function]++;
+    }
+
+    // Move node to a new row and make it a LOOP_INVARIANT node for that row,
+    // so its parent does not change
+    void cache(FlatNode node, std::vector<uint32_t>& slots) {
+        FlatNode moved = builder.copyRow(columns, node);
+
+        uint32_t slot = newSlot();
+        columns.kinds[node] = NODE_LOOP_INVARIANT;
+        columns.ops[node] = 0;
+        columns.a[node] = moved;
+        columns.b[node] = 0;
+        columns.c[node] = slot;
+        columns.d[node] = 0;
+        columns.e[node] = 0;
+        slots.push_back(slot);
+    }
+
+    // Cache the largest invariant expressions in node
+    void hoist(FlatNode node, const Effects& effects, std::vector<uint32_t>& slots) {
+        uint8_t kind = columns.kinds[node];
+        bool worthIt = kind == NODE_UNARY_OP || kind == NODE_BINARY_OP || kind == NODE_FUNCTION_CALL ||
+            kind == NODE_ATTRIBUTE_ACCESS || kind == NODE_INDEX_ACCESS;
+        if (worthIt && invariant(node, effects)) {
+            cache(node, slots);
+            return;
+        }
+
+        // Targets of assignments and callees are not values of their own
+        std::vector<FlatNode> nodes = children(node, false);
+        for (FlatNode child : nodes) {
+            if (kind == NODE_ATTRIBUTE_ASSIGN && child == columns.a[node]) {
+                hoist(columns.a[child], effects, slots);
+            }
+            else if ((kind == NODE_FUNCTION_CALL || kind == NODE_INLINED_CALL) && child == columns.a[node]) {
+                continue;
+            }
+            else {
+                hoist(child, effects, slots);
+            }
+        }
+    }
+
+    void loop(FlatNode node) {
+        // The initialization of a for loop runs once
+        Effects effects;
+        std::vector<FlatNode> region = children(node, false);
+        if (columns.kinds[node] == NODE_FOR && columns.a[node] != NO_NODE) {
+            region.erase(region.begin());
+        }
+        for (FlatNode child : region) {
+            this->effects(child, effects);
+        }
+
+        std::vector<uint32_t> slots;
+        for (FlatNode child : region) {
+            hoist(child, effects, slots);
+        }
+        if (!slots.empty()) {
+            columns.ops[node] = 1;
+            columns.e[node] = builder.list(slots);
+        }
+    }
+
+    // Find the loops in node, outer loops first
+    void walk(FlatNode node) {
+        uint8_t kind = columns.kinds[node];
+        if (kind == NODE_WHILE || kind == NODE_FOR) {
+            loop(node);
+        }
+        if (kind == NODE_FUNCTION_DEF) {
+            if (columns.ops[node] != 0) {
+                return;
+            }
+            FlatNode outerFunction = function;
+            bool outerEscape = localsEscape;
+            function = node;
+            localsEscape = false;
+            for (FlatNode statement : columns.list(columns.c[node])) {
+                localsEscape = localsEscape || assignsOuter(statement, false);
+            }
+            for (FlatNode statement : columns.list(columns.c[node])) {
+                walk(statement);
+            }
+            function = outerFunction;
+            localsEscape = outerEscape;
+            return;
+        }
+        for (FlatNode child : children(node, true)) {
+            walk(child);
+        }
+    }
+
+public:
+    LoopInvariantMotion(FlatAstBuilder& builder, uint32_t frameSize) : builder(builder), columns(builder.columns) {
+        this->programFrameSize = frameSize;
+    }
+
+    // Move invariants out of the loops in the statements of listRef, returns
+    // the new frame size of the statements
+    uint32_t run(uint32_t listRef) {
+        for (FlatNode statement : columns.list(listRef)) {
+            localsEscape = localsEscape || assignsOuter(statement, false);
+        }
+        for (FlatNode statement : columns.list(listRef)) {
+            walk(statement);
+        }
+        return programFrameSize;
+    }
+};
+
+// Replaces the most common shapes of statements and expressions with a
+// single node the interpreter runs without visiting the nodes below it:
+//   - x = x + n and x = x - n, for an INT n
+//   - a variable compared to an INT, as in loop conditions
+//   - v.f = v.f op value, which reads v and looks up f once
+//   - print and println of one argument
+//   - for loops that count a local variable up or down by an INT step
+//     while it compares to a bound, see countedLoop
+// The nodes below are kept, the interpreter falls back to them whenever the
+// values are not the ones the fused node is made for. A fused node keeps
+// the operands of the node it was made from, see unfusedKind.
+//
+// Runs after every other pass, the others do not know the fused kinds.
+class SuperinstructionFuser {
+private:
+    FlatAstColumns& columns;
+    const std::vector<std::string>& strings;
+    FusionStats stats;
+
+    bool isInt(FlatNode node) {
+        return columns.kinds[node] == NODE_INT;
+    }
+
+    // Whether both nodes read the same variable
+    bool sameVariable(FlatNode x, FlatNode y) {
+        if (columns.kinds[x] != NODE_VAR_ACCESS || columns.kinds[y] != NODE_VAR_ACCESS || columns.c[x] != columns.c[y]) {
+            return false;
+        }
+        return columns.c[x] == GLOBAL_SCOPE ? columns.a[x] == columns.a[y] : columns.d[x] == columns.d[y];
+    }
+
+    bool isIncrement(FlatNode node) {
+        FlatNode value = columns.b[node];
+        if (columns.kinds[value] != NODE_BINARY_OP || (columns.ops[value] != OP_ADD && columns.ops[value] != OP_SUB)) {
+            return false;
+        }
+        FlatNode variable = columns.a[value];
+        if (columns.kinds[variable] != NODE_VAR_ACCESS || columns.c[variable] != columns.c[node] || !isInt(columns.b[value])) {
+            return false;
+        }
+        return columns.c[node] == GLOBAL_SCOPE ? columns.a[variable] == columns.a[node] : columns.d[variable] == columns.d[node];
+    }
+
+    bool isConstantComparison(FlatNode node) {
+        int16_t op = columns.ops[node];
+        return op >= OP_LT && op <= OP_NE && columns.kinds[columns.a[node]] == NODE_VAR_ACCESS && isInt(columns.b[node]);
+    }
+
+    bool isFieldUpdate(FlatNode node) {
+        FlatNode target = columns.a[node];
+        FlatNode value = columns.b[node];
+        if (columns.kinds[value] != NODE_BINARY_OP || columns.kinds[columns.a[value]] != NODE_ATTRIBUTE_ACCESS) {
+            return false;
+        }
+        FlatNode read = columns.a[value];
+        return columns.b[read] == columns.b[target] && sameVariable(columns.a[target], columns.a[read]);
+    }
+
+    // Whether node assigns slot of the current frame
+    bool assignsLocal(FlatNode node, uint32_t slot) {
+        uint8_t kind = unfusedKind(columns.kinds[node]);
+        return kind == NODE_VAR_ASSIGN && columns.c[node] == 0 && columns.d[node] == slot;
+    }
+
+    bool readsLocal(FlatNode node, uint32_t slot) {
+        return columns.kinds[node] == NODE_VAR_ACCESS && columns.c[node] == 0 && columns.d[node] == slot;
+    }
+
+    // Whether the FOR node declares a local Int counter, compares it to a
+    // bound without effects and steps it by an INT, and nothing else in the
+    // loop assigns the counter. Functions and structures defined in the
+    // body could keep the counter, they rule the loop out. Sets readsCounter
+    // if the body reads it.
+    bool countedLoop(FlatNode node, bool& readsCounter) {
+        FlatNode init = columns.a[node], condition = columns.b[node], update = columns.c[node];
+        if (init == NO_NODE || condition == NO_NODE || update == NO_NODE) {
+            return false;
+        }
+        if (columns.kinds[init] != NODE_VAR_DECLARATION || columns.c[init] == GLOBAL_SCOPE || columns.d[init] > TYPE_INT) {
+            return false;
+        }
+        uint32_t slot = columns.c[init];
+
+        int16_t op = columns.ops[condition];
+        if (unfusedKind(columns.kinds[condition]) != NODE_BINARY_OP || op < OP_LT || op > OP_GTE ||
+            !readsLocal(columns.a[condition], slot)) {
+            return false;
+        }
+        FlatNode bound = columns.b[condition];
+        uint8_t boundKind = columns.kinds[bound];
+        if (boundKind != NODE_INT && boundKind != NODE_LOOP_INVARIANT && (boundKind != NODE_VAR_ACCESS || readsLocal(bound, slot))) {
+            return false;
+        }
+
+        FlatNode sum = columns.b[update];
+        if (!assignsLocal(update, slot) || columns.ops[update] > TYPE_INT || unfusedKind(columns.kinds[sum]) != NODE_BINARY_OP ||
+            (columns.ops[sum] != OP_ADD && columns.ops[sum] != OP_SUB) || !readsLocal(columns.a[sum], slot) || !isInt(columns.b[sum])) {
+            return false;
+        }
+
+        readsCounter = false;
+        std::vector<FlatNode> pending = childNodes(columns, node, true);
+        while (!pending.empty()) {
+            FlatNode child = pending.back();
+            pending.pop_back();
+            uint8_t kind = columns.kinds[child];
+            if (kind == NODE_FUNCTION_DEF || kind == NODE_STRUCT_DEF || (child != update && assignsLocal(child, slot))) {
+                return false;
+            }
+            if (child != columns.a[condition] && child != columns.a[sum] && readsLocal(child, slot)) {
+                readsCounter = true;
+            }
+            for (FlatNode grandchild : childNodes(columns, child, true)) {
+                pending.push_back(grandchild);
+            }
+        }
+        return true;
+    }
+
+    // 1 for println, 0 for print, -1 for any other call
+    int printCall(FlatNode node) {
+        FlatNode callee = columns.a[node];
+        if (columns.kinds[callee] != NODE_VAR_ACCESS || columns.c[callee] != GLOBAL_SCOPE || columns.lists[columns.b[node]] != 1) {
+            return -1;
+        }
+        const std::string& name = strings[columns.a[callee]];
+        return name == "println" ? 1 : name == "print" ? 0 : -1;
+    }
+
+    void fuse(FlatNode node) {
+        switch (columns.kinds[node]) {
+        case NODE_VAR_ASSIGN:
+            if (isIncrement(node)) {
+                columns.kinds[node] = NODE_INCREMENT;
+                stats.increments++;
+            }
+            break;
+        case NODE_BINARY_OP:
+            if (isConstantComparison(node)) {
+                columns.kinds[node] = NODE_COMPARE_CONSTANT;
+                stats.comparisons++;
+            }
+            break;
+        case NODE_ATTRIBUTE_ASSIGN:
+            if (isFieldUpdate(node)) {
+                columns.kinds[node] = NODE_UPDATE_FIELD;
+                stats.fieldUpdates++;
+            }
+            break;
+        case NODE_FOR: {
+            bool readsCounter;
+            if (countedLoop(node, readsCounter)) {
+                columns.kinds[node] = NODE_COUNTED_FOR;
+                columns.ops[node] |= readsCounter ? 2 : 0;
+                stats.countedLoops++;
+            }
+            break;
+        }
+        case NODE_FUNCTION_CALL: {
+            int print = printCall(node);
+            if (print >= 0) {
+                columns.kinds[node] = NODE_PRINT;
+                columns.ops[node] = (int16_t)print;
+                stats.prints++;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+public:
+    SuperinstructionFuser(FlatAstBuilder& builder) : columns(builder.columns), strings(builder.strings) {}
+
+    // Fuse every row of the table. Rows no list refers to any more are
+    // fused as well, which does no harm.
+    const FusionStats& run() {
+        for (FlatNode node = 0; node < (FlatNode)columns.kinds.size(); node++) {
+            fuse(node);
+        }
+        return stats;
+    }
+};
+
+inline FlatAst FlatAst::build(std::vector<AstNode>& statements, SourceBuffer_sPtr source) {
+    FlatAstBuilder builder;
+    uint32_t program = builder.nodeList(NodeList(statements));
+    uint32_t frameSize = Resolver(builder, source).program(program);
+    DeadCodeEliminator eliminator(builder);
+    program = eliminator.program(program, true);
+    FlatAstBuilder& result = eliminator.result();
+    frameSize = LoopInvariantMotion(result, frameSize).run(program);
+    {
+        FlatAst definitions = FlatAst::view(result, program, frameSize, source);
+        frameSize = ConstantCallFolder(definitions, result, frameSize).run(program);
+    }
+    FusionStats fusions = SuperinstructionFuser(result).run();
+    FlatAst ast(std::unique_ptr<FlatAstColumns>(new FlatAstColumns(std::move(result.columns))),
+        std::move(result.strings), program, frameSize);
+    ast.source = source;
+    ast.deadCode = eliminator.statistics();
+    ast.fusions = fusions;
+    return ast;
+}
+
+inline const FlatAst& FlatAst::compileBody(FlatNode node) const {
+    std::unique_ptr<FlatAst>& body = compiledBodies[node];
+    if (body == nullptr) {
+        // The nodes are only needed until they are flattened
+        AstArena arena;
+        Lexer lexer(source, c[node], c[node] + d[node]);
+        LexerTokenStream tokens(lexer);
+        Parser parser(tokens, source, arena);
+        parser.setLazyFunctions(false);
+        std::vector<AstNode> statements = parser.parse();
+
+        // The arguments come first in the frame, they are interned ahead of the body
+        FlatAstBuilder builder;
+        std::vector<uint32_t> argNames;
+        for (uint32_t argName : list(b[node])) {
+            argNames.push_back(builder.intern(string(argName)));
+        }
+        std::vector<Resolver::Constant> globalConstants;
+        for (FlatNode constant : literalConstants()) {
+            if (spans[constant].offset > spans[node].offset) {
+                break; // May not have run yet when the function is called
+            }
+            FlatNode value = b[constant];
+            uint32_t literal = kinds[value] == NODE_STRING ? builder.intern(string(a[value])) : a[value];
+            globalConstants.push_back(Resolver::Constant{ builder.intern(string(a[constant])), kinds[value], literal });
+        }
+        uint32_t program = builder.nodeList(NodeList(statements));
+        uint32_t frameSize = Resolver(builder, source).body(program, argNames, globalConstants);
+        compiling.insert(node);
+        frameSize = Inliner(*this, builder, frameSize).run(program);
+        frameSize = ConstantCallFolder(*this, builder, frameSize).run(program);
+        compiling.erase(node);
+        ScalarReplacement replacement(*this, builder, frameSize);
+        frameSize = replacement.run(program);
+        DeadCodeEliminator eliminator(builder);
+        program = eliminator.program(program, false);
+        FlatAstBuilder& result = eliminator.result();
+        frameSize = LoopInvariantMotion(result, frameSize).run(program);
+        FusionStats fused = SuperinstructionFuser(result).run();
+        body.reset(new FlatAst(std::unique_ptr<FlatAstColumns>(new FlatAstColumns(std::move(result.columns))),
+            std::move(result.strings), program, frameSize));
+        body->source = source;
+        body->parent = this;
+        body->frameEscapes = false;
+        for (FlatNode n = 0; n < body->size(); n++) {
+            if (body->kinds[n] == NODE_FUNCTION_DEF || body->kinds[n] == NODE_STRUCT_DEF) {
+                body->frameEscapes = true;
+            }
+        }
+        body->deadCode = eliminator.statistics();
+        deadCode.add(body->deadCode);
+        body->fusions = fused;
+        fusions.add(fused);
+        body->scalarReplacement = replacement.statistics();
+        scalarReplacement.add(replacement.statistics());
+    }
+    return *body;
+}
+
+inline const std::vector<FlatNode>& FlatAst::literalConstants() const {
+    if (constants == nullptr) {
+        constants.reset(new std::vector<FlatNode>());
+        for (FlatNode node : list(program)) {
+            if (kinds[node] == NODE_VAR_DECLARATION && ops[node] != 0) {
+                uint8_t valueKind = kinds[b[node]];
+                if (valueKind == NODE_INT || valueKind == NODE_FLOAT || valueKind == NODE_STRING) {
+                    constants->push_back(node);
+                }
+            }
+        }
+    }
+    return *constants;
+}
+
+inline const std::unordered_map<std::string, FlatNode>& FlatAst::topLevelFunctions() const {
+    if (functions == nullptr) {
+        functions.reset(new std::unordered_map<std::string, FlatNode>());
+        for (FlatNode node : list(program)) {
+            if (kinds[node] == NODE_FUNCTION_DEF) {
+                functions->emplace(string(a[node]), node);
+            }
+        }
+    }
+    return *functions;
+}
+
+inline const std::unordered_map<std::string, FlatNode>& FlatAst::topLevelStructures() const {
+    if (structures == nullptr) {
+        structures.reset(new std::unordered_map<std::string, FlatNode>());
+        for (FlatNode node : list(program)) {
+            if (kinds[node] == NODE_STRUCT_DEF) {
+                structures->emplace(string(a[node]), node);
+            }
+        }
+    }
+    return *structures;
+}
+
+inline FlatAst FlatAst::view(const FlatAstBuilder& builder, uint32_t program, uint32_t frameSize, SourceBuffer_sPtr source) {
+    FlatAst ast;
+    const FlatAstColumns& columns = builder.columns;
+    ast.kinds = columns.kinds.data();
+    ast.ops = columns.ops.data();
+    ast.a = columns.a.data();
+    ast.b = columns.b.data();
+    ast.c = columns.c.data();
+    ast.d = columns.d.data();
+    ast.e = columns.e.data();
+    ast.spans = columns.spans.data();
+    ast.lists = columns.lists.data();
+    ast.nodeCount = (uint32_t)columns.kinds.size();
+    ast.listsSize = (uint32_t)columns.lists.size();
+    ast.strings = builder.strings;
+    ast.program = program;
+    ast.frameSize = frameSize;
+    ast.source = source;
+    return ast;
+}
+
+inline bool FlatAst::isPure(FlatNode definition) const {
+    auto found = purity.find(definition);
+    if (found != purity.end()) {
+        return found->second;
+    }
+    if (ops[definition] == 0 || isCompiling(definition)) {
+        return false;
+    }
+
+    purity[definition] = false;
+    const FlatAst* body;
+    try {
+        body = &compileBody(definition);
+    }
+    catch (Exception e) {
+        return false;
+    }
+
+    const std::string& name = string(a[definition]);
+    for (FlatNode node = 0; node < body->size(); node++) {
+        switch (unfusedKind(body->kinds[node])) {
+        case NODE_IMPORT:
+        case NODE_FUNCTION_DEF:
+        case NODE_STRUCT_DEF:
+        case NODE_CONSTRUCTOR_CALL:
+        case NODE_ATTRIBUTE_ASSIGN:
+        case NODE_LIST:
+            return false;
+        case NODE_VAR_ASSIGN:
+            if (body->c[node] == GLOBAL_SCOPE) {
+                return false;
+            }
+            break;
+        case NODE_VAR_ACCESS: {
+            if (body->c[node] != GLOBAL_SCOPE) {
+                break;
+            }
+            const std::string& global = body->string(body->a[node]);
+            if (global != name && global != "true" && global != "false" && global != "null" &&
+                pureFunctions().find(global) == pureFunctions().end()) {
+                return false;
+            }
+            break;
+        }
+        case NODE_BINARY_OP: {
+            uint32_t types = body->c[node];
+            if (body->ops[node] == OP_DIV && (types >> 8) != TYPE_FLOAT && (types & 0xFF) != TYPE_FLOAT) {
+                return false;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    purity[definition] = true;
+    return true;
+}
+
+inline bool FlatAst::evaluateCall(FlatNode definition, const std::vector<LiteralValue>& args, LiteralValue& result) const {
+    if (callEvaluator() == nullptr || !isPure(definition)) {
+        return false;
+    }
+
+    std::string key = std::to_string(definition);
+    for (const LiteralValue& arg : args) {
+        key += ":" + std::to_string(arg.kind) + "," + std::to_string(arg.value) + "," + std::to_string(arg.text.size()) + "," + arg.text;
+    }
+    auto found = evaluations.find(key);
+    if (found == evaluations.end()) {
+        LiteralValue value;
+        if (!callEvaluator()(*this, definition, args, value)) {
+            value = LiteralValue();
+        }
+        found = evaluations.emplace(key, value).first;
+    }
+    result = found->second;
+    return result.kind != 0;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "exception/Exception.h"
+#include "lexer/SourceBuffer.h"
+#include "lexer/Lexer.h"
+#include "lexer/TokenStream.h"
+#include "AstArena.h"
+#include "AstNode.h"
+#include "Parser.h"
+#include "StatementBoundaries.h"
+
+// Front-end for scripts that are loaded again after they were edited. The
+// source is kept as a list of top-level statement ranges together with the
+// statements parsed from them. On reload only the ranges that overlap the edit
+// are lexed and parsed again, the statements of all other ranges are reused.
+// Each range shares ownership of the arena its statements were parsed into,
+// so an arena is released once none of its statements are left.
+//
+// Whenever the edited ranges fail to lex or parse, the whole input is parsed
+// again, so errors are reported exactly as in a full parse.
+class IncrementalParser {
+public:
+    typedef std::vector<AstNode>(*FullParse)(SourceBuffer_sPtr source, AstArena& arena);
+
+private:
+    struct Segment {
+        uint32_t begin, end;
+        std::vector<AstNode> statements;
+        AstArena_sPtr arena;
+    };
+
+    FullParse fullParse;
+    bool loaded = false;
+    std::string text; // Copy of the last parsed source, a mapped file may change under us
+    std::vector<Segment> segments;
+
+    uint32_t reparsedBytes = 0;
+    uint32_t reusedStatements = 0;
+
+public:
+    IncrementalParser(FullParse fullParse) {
+        this->fullParse = fullParse;
+    }
+
+    // Bytes that were lexed and parsed by the last call to parse()
+    uint32_t getReparsedBytes() {
+        return reparsedBytes;
+    }
+
+    // Top level statements that the last call to parse() took from the previous version
+    uint32_t getReusedStatements() {
+        return reusedStatements;
+    }
+
+    // The statements stay valid until the next call to parse()
+    std::vector<AstNode> parse(SourceBuffer_sPtr source) {
+        if (!loaded) {
+            return parseAll(source);
+        }
+
+        std::string_view newText = source->getText();
+        uint32_t oldLength = (uint32_t)text.size();
+        uint32_t newLength = (uint32_t)newText.size();
+
+        // The edit lies between the common prefix and the common suffix
+        uint32_t limit = std::min(oldLength, newLength);
+        uint32_t prefix = (uint32_t)(std::mismatch(text.begin(), text.begin() + limit, newText.begin()).first - text.begin());
+        if (prefix == oldLength && oldLength == newLength) {
+            reparsedBytes = 0;
+            reusedStatements = 0;
+            std::vector<AstNode> ast;
+            for (Segment& segment : segments) {
+                ast.insert(ast.end(), segment.statements.begin(), segment.statements.end());
+                reusedStatements += (uint32_t)segment.statements.size();
+            }
+            return ast;
+        }
+        uint32_t suffix = (uint32_t)(std::mismatch(text.rbegin(), text.rbegin() + (limit - prefix), newText.rbegin()).first - text.rbegin());
+        int64_t delta = (int64_t)newLength - (int64_t)oldLength;
+
+        // Ranges that end inside the common prefix are unchanged. The last range
+        // is not necessarily closed by a ';', so it is always parsed again.
+        size_t first = 0;
+        while (first + 1 < segments.size() && segments[first].end <= prefix) {
+            first++;
+        }
+        uint32_t dirtyBegin = segments[first].begin;
+
+        // Find the new boundaries from there on, until one of them lines up
+        // with an old boundary inside the common suffix. Both scans are in the
+        // same state at such a boundary and see the same text after it, so the
+        // old ranges from there on are still valid.
+        std::vector<uint32_t> newBoundaries;
+        newBoundaries.push_back(dirtyBegin);
+        size_t resync = segments.size();
+        StatementBoundaryScanner scanner(newText.data(), newLength, dirtyBegin);
+        while (true) {
+            uint32_t boundary = scanner.next();
+            newBoundaries.push_back(boundary);
+            if (boundary >= newLength) break;
+            if ((int64_t)boundary - delta >= (int64_t)(oldLength - suffix)) {
+                size_t match = findSegment((uint32_t)((int64_t)boundary - delta), first);
+                if (match < segments.size()) {
+                    resync = match;
+                    break;
+                }
+            }
+        }
+        uint32_t dirtyEnd = newBoundaries.back();
+
+        AstArena_sPtr arena(new AstArena());
+        std::vector<AstNode> dirtyStatements;
+        try {
+            Lexer lexer(source, dirtyBegin, dirtyEnd);
+            LexerTokenStream tokens(lexer);
+            Parser parser(tokens, source, *arena);
+            dirtyStatements = parser.parse();
+        }
+        catch (Exception e) {
+            return parseAll(source);
+        }
+
+        std::vector<Segment> updated;
+        updated.reserve(first + (newBoundaries.size() - 1) + (segments.size() - resync));
+        for (size_t i = 0; i < first; i++) {
+            updated.push_back(std::move(segments[i]));
+        }
+
+        size_t next = 0;
+        for (size_t i = 0; i + 1 < newBoundaries.size(); i++) {
+            Segment segment;
+            segment.begin = newBoundaries[i];
+            segment.end = newBoundaries[i + 1];
+            segment.arena = arena;
+            while (next < dirtyStatements.size() && dirtyStatements[next]->span.offset < segment.end) {
+                segment.statements.push_back(dirtyStatements[next++]);
+            }
+            updated.push_back(std::move(segment));
+        }
+
+        for (size_t i = resync; i < segments.size(); i++) {
+            Segment& segment = segments[i];
+            if (delta != 0) {
+                segment.begin = (uint32_t)(segment.begin + delta);
+                segment.end = (uint32_t)(segment.end + delta);
+                for (AstNode& statement : segment.statements) {
+                    relocate(statement, (int32_t)delta);
+                }
+            }
+            updated.push_back(std::move(segment));
+        }
+
+        segments = std::move(updated);
+        text.assign(newText.data(), newText.size());
+        reparsedBytes = dirtyEnd - dirtyBegin;
+
+        std::vector<AstNode> ast;
+        reusedStatements = 0;
+        for (size_t i = 0; i < segments.size(); i++) {
+            ast.insert(ast.end(), segments[i].statements.begin(), segments[i].statements.end());
+            if (i < first || i >= first + newBoundaries.size() - 1) {
+                reusedStatements += (uint32_t)segments[i].statements.size();
+            }
+        }
+        return ast;
+    }
+
+private:
+    // Parse the whole input and split the statements into ranges
+    std::vector<AstNode> parseAll(SourceBuffer_sPtr source) {
+        loaded = false;
+        segments.clear();
+        text.clear();
+
+        AstArena_sPtr arena(new AstArena());
+        std::vector<AstNode> ast = fullParse(source, *arena);
+
+        StatementBoundaryScanner scanner(source->data(), source->size());
+        uint32_t begin = 0;
+        size_t next = 0;
+        while (true) {
+            Segment segment;
+            segment.begin = begin;
+            segment.end = scanner.next();
+            segment.arena = arena;
+            while (next < ast.size() && ast[next]->span.offset < segment.end) {
+                segment.statements.push_back(ast[next++]);
+            }
+            begin = segment.end;
+            segments.push_back(std::move(segment));
+            if (begin >= source->size()) break;
+        }
+
+        text.assign(source->data(), source->size());
+        loaded = true;
+        reparsedBytes = source->size();
+        reusedStatements = 0;
+        return ast;
+    }
+
+    // Index of the range that starts at offset, or segments.size()
+    size_t findSegment(uint32_t offset, size_t from) {
+        auto it = std::lower_bound(segments.begin() + from, segments.end(), offset,
+            [](const Segment& segment, uint32_t value) { return segment.begin < value; });
+        if (it != segments.end() && it->begin == offset) {
+            return it - segments.begin();
+        }
+        return segments.size();
+    }
+
+    // Move the spans of a reused subtree to where its text is in the new source
+    static void relocate(AstNodeBase* node, int32_t delta) {
+        node->span.offset = (uint32_t)((int64_t)node->span.offset + delta);
+        if (node->type == NODE_FUNCTION_DEF && static_cast<FunctionDefNode*>(node)->lazy) {
+            Span& body = static_cast<FunctionDefNode*>(node)->body;
+            body.offset = (uint32_t)((int64_t)body.offset + delta);
+        }
+        forEachChild(node, [delta](AstNode& child) {
+            relocate(child, delta);
+        });
+    }
+};
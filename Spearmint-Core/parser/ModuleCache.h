@@ -0,0 +1,324 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <filesystem>
+#include <utility>
+
+#include "exception/Exception.h"
+#include "lexer/SourceBuffer.h"
+#include "lexer/Lexer.h"
+#include "util/ThreadPool.h"
+#include "AstArena.h"
+#include "AstNode.h"
+#include "FlatAst.h"
+#include "ProgramCache.h"
+
+// A file loaded by an import statement
+class Module {
+public:
+    std::string path;
+    FlatAst program;
+
+    // Module named by each import node of program
+    std::vector<std::pair<FlatNode, std::shared_ptr<Module>>> imports;
+
+    // Module named by each import in a function body the parser skipped, by
+    // the name it is imported as
+    std::vector<std::pair<std::string, std::shared_ptr<Module>>> bodyImports;
+
+    // Ready once program and imports are filled in, holds the error otherwise
+    std::shared_future<void> loaded;
+
+    Module(std::string path) {
+        this->path = path;
+    }
+};
+
+typedef std::shared_ptr<Module> Module_sPtr;
+
+// Modules reachable from one program through its imports
+class ModuleGraph {
+public:
+    std::vector<Module_sPtr> modules;
+
+    // Target of each import node by the tree it is in. A null target is an
+    // import of the program itself.
+    std::map<std::pair<const FlatAst*, FlatNode>, Module*> targets;
+
+    // Target of each import in a skipped function body by the tree the
+    // function is defined in and the module name. The body is only compiled
+    // when it is first called, so its nodes are not known while loading.
+    std::map<std::pair<const FlatAst*, std::string>, Module*> bodyTargets;
+
+    // Returns false if node was not resolved by the loader
+    bool target(const FlatAst* ast, FlatNode node, Module*& module) const {
+        auto found = targets.find(std::make_pair(ast, node));
+        if (found != targets.end()) {
+            module = found->second;
+            return true;
+        }
+        if (ast->parent == nullptr) {
+            return false;
+        }
+        auto byName = bodyTargets.find(std::make_pair(ast->parent, ast->string(ast->a[node])));
+        if (byName == bodyTargets.end()) {
+            return false;
+        }
+        module = byName->second;
+        return true;
+    }
+};
+
+// Process wide store of parsed modules. Every file is lexed and parsed at most
+// once, however many modules import it, and stays cached until it or a module
+// it imports changes on disk. A module is parsed on the thread pool as soon as
+// the first import of it is seen, so modules that do not depend on each other
+// load in parallel.
+//
+// Tasks on the pool never wait for each other, only the thread that asked for
+// a graph does. The parse function therefore must not wait for the pool either.
+class ModuleCache {
+public:
+    typedef std::vector<AstNode>(*Parse)(SourceBuffer_sPtr source, AstArena& arena);
+
+private:
+    struct Entry {
+        Module_sPtr module;
+        std::filesystem::file_time_type modified;
+        uintmax_t size = 0;
+    };
+
+    Parse parse;
+    ThreadPool* pool;
+    std::unordered_map<std::string, Entry> entries;
+    std::mutex mutex;
+
+    // Absolute, normalized path of name as imported from the file importer
+    static std::string resolve(const std::string& importer, std::string_view name) {
+        std::filesystem::path path(name);
+        if (path.is_relative()) {
+            path = std::filesystem::path(importer).parent_path() / path;
+        }
+        std::error_code error;
+        path = std::filesystem::absolute(path, error);
+        std::filesystem::path resolved = std::filesystem::weakly_canonical(path, error);
+        if (error) {
+            resolved = path.lexically_normal();
+        }
+        return resolved.string();
+    }
+
+    // Import nodes anywhere in program
+    static std::vector<FlatNode> findImports(const FlatAst& program) {
+        std::vector<FlatNode> imports;
+        for (FlatNode node = 0; node < program.size(); node++) {
+            if (program.kinds[node] == NODE_IMPORT) {
+                imports.push_back(node);
+            }
+        }
+        return imports;
+    }
+
+    // Module names of the import statements in the function bodies the parser
+    // skipped. Their tokens are read again here, but only for bodies that
+    // contain the word at all.
+    static std::vector<std::string> findBodyImports(const FlatAst& program) {
+        std::vector<std::string> names;
+        for (FlatNode node = 0; node < program.size(); node++) {
+            if (program.kinds[node] != NODE_FUNCTION_DEF || program.ops[node] == 0) {
+                continue;
+            }
+            uint32_t begin = program.c[node];
+            uint32_t end = begin + program.d[node];
+            if (std::string_view(program.source->data() + begin, end - begin).find("import") == std::string_view::npos) {
+                continue;
+            }
+            Lexer lexer(program.source, begin, end);
+            Token previous = lexer.next();
+            while (!previous.matches(END)) {
+                Token token = lexer.next();
+                if (previous.matches(KEYWORD, KW_IMPORT) && token.matches(STRING)) {
+                    names.emplace_back(token.value);
+                }
+                previous = token;
+            }
+        }
+        return names;
+    }
+
+    // Modules already requested for one graph or one loaded module by path.
+    // Every file is checked once per request and import cycles end there.
+    typedef std::unordered_map<std::string, Module_sPtr> Requested;
+
+    // Whether the modules a cached module imported are still the ones cached
+    // for their paths. One that is still loading requests its imports itself.
+    bool importsCurrent(const Module& module, Requested& requested) {
+        if (module.loaded.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return true;
+        }
+        for (auto& import : module.imports) {
+            if (request(import.second->path, requested) != import.second) {
+                return false;
+            }
+        }
+        for (auto& import : module.bodyImports) {
+            if (request(import.second->path, requested) != import.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Module for path, loading the file if it or anything it imports is not
+    // cached or changed since
+    Module_sPtr request(const std::string& path, Requested& requested) {
+        auto seen = requested.find(path);
+        if (seen != requested.end()) {
+            return seen->second;
+        }
+
+        std::error_code error;
+        std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, error);
+        uintmax_t size = error ? 0 : std::filesystem::file_size(path, error);
+        bool exists = !error;
+
+        Module_sPtr cached;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = entries.find(path);
+            if (exists && found != entries.end() && found->second.modified == modified && found->second.size == size) {
+                cached = found->second.module;
+            }
+        }
+        if (cached != nullptr) {
+            requested[path] = cached;
+            if (importsCurrent(*cached, requested)) {
+                return cached;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Files that could not be read are tried again on every request
+        Entry entry;
+        entry.module.reset(new Module(path));
+        entry.modified = modified;
+        entry.size = size;
+        Module_sPtr module = entry.module;
+        module->loaded = pool->submit([this, module] { load(*module); }).share();
+        if (exists) {
+            entries[path] = entry;
+        }
+        requested[path] = entry.module;
+        return entry.module;
+    }
+
+    // Runs on the pool. Requests the imports of module before returning, so
+    // they are already loading when the caller gets to them.
+    void load(Module& module) {
+        SourceBuffer_sPtr source;
+        try {
+            source = SourceBuffer::fromFile(module.path);
+        }
+        catch (Exception e) {
+            throw Exception("Cannot import '" + module.path + "'. " + e.getMessage());
+        }
+
+        std::string cacheFile = ProgramCache::pathFor(module.path);
+        if (!ProgramCache::load(cacheFile, source, module.program)) {
+            AstArena arena;
+            std::vector<AstNode> ast = parse(source, arena);
+            module.program = FlatAst::build(ast, source);
+            ProgramCache::store(cacheFile, *source, module.program);
+        }
+
+        Requested requested;
+        for (FlatNode node : findImports(module.program)) {
+            const std::string& name = module.program.string(module.program.a[node]);
+            module.imports.push_back(std::make_pair(node, request(resolve(module.path, name), requested)));
+        }
+        for (std::string& name : findBodyImports(module.program)) {
+            Module_sPtr imported = request(resolve(module.path, name), requested);
+            module.bodyImports.push_back(std::make_pair(std::move(name), imported));
+        }
+    }
+
+public:
+    ModuleCache(Parse parse, ThreadPool& pool) {
+        this->parse = parse;
+        this->pool = &pool;
+    }
+
+    ModuleCache(const ModuleCache&) = delete;
+    ModuleCache& operator=(const ModuleCache&) = delete;
+
+    // Load everything program imports, directly or not. fileName is the file
+    // program was read from, imports are relative to its directory. Throws the
+    // first error of any module in the graph.
+    ModuleGraph load(const FlatAst& program, const std::string& fileName) {
+        ModuleGraph graph;
+        std::string self = resolve("", fileName);
+        Requested requested;
+
+        // Start all direct imports before waiting for any of them
+        std::deque<Module_sPtr> pending;
+        for (FlatNode node : findImports(program)) {
+            std::string path = resolve(fileName, program.string(program.a[node]));
+            if (path == self) {
+                graph.targets[std::make_pair(&program, node)] = nullptr;
+                continue;
+            }
+            Module_sPtr module = request(path, requested);
+            graph.targets[std::make_pair(&program, node)] = module.get();
+            pending.push_back(module);
+        }
+        for (const std::string& name : findBodyImports(program)) {
+            std::string path = resolve(fileName, name);
+            if (path == self) {
+                graph.bodyTargets[std::make_pair(&program, name)] = nullptr;
+                continue;
+            }
+            Module_sPtr module = request(path, requested);
+            graph.bodyTargets[std::make_pair(&program, name)] = module.get();
+            pending.push_back(module);
+        }
+
+        std::unordered_set<Module*> visited;
+        while (!pending.empty()) {
+            Module_sPtr module = pending.front();
+            pending.pop_front();
+            if (!visited.insert(module.get()).second) {
+                continue;
+            }
+
+            module->loaded.get();
+            graph.modules.push_back(module);
+            for (auto& import : module->imports) {
+                if (import.second->path == self) {
+                    graph.targets[std::make_pair(&module->program, import.first)] = nullptr;
+                    continue;
+                }
+                graph.targets[std::make_pair(&module->program, import.first)] = import.second.get();
+                pending.push_back(import.second);
+            }
+            for (auto& import : module->bodyImports) {
+                if (import.second->path == self) {
+                    graph.bodyTargets[std::make_pair(&module->program, import.first)] = nullptr;
+                    continue;
+                }
+                graph.bodyTargets[std::make_pair(&module->program, import.first)] = import.second.get();
+                pending.push_back(import.second);
+            }
+        }
+        return graph;
+    }
+};
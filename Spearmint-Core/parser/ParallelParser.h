@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vector>
+#include <future>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+
+#include "exception/Exception.h"
+#include "lexer/SourceBuffer.h"
+#include "lexer/Lexer.h"
+#include "lexer/TokenStream.h"
+#include "util/ThreadPool.h"
+#include "AstArena.h"
+#include "AstNode.h"
+#include "Parser.h"
+#include "StatementBoundaries.h"
+
+// Front-end for very large inputs. A pre-scan splits the source at top-level
+// statement boundaries, then each chunk is lexed and parsed on the thread pool
+// and the results are joined in source order. Every chunk gets an arena of its
+// own, which is merged into the caller's arena once the chunk is done.
+//
+// A chunk that fails to lex or parse does not report its own error. The whole
+// input is parsed again serially instead, so the error is exactly the one a
+// serial parse would report.
+class ParallelParser {
+private:
+    SourceBuffer_sPtr source;
+    ThreadPool* pool;
+    AstArena* arena;
+
+    struct Chunk {
+        std::unique_ptr<AstArena> arena;
+        std::vector<AstNode> statements;
+    };
+
+public:
+    static const uint32_t MIN_CHUNK_BYTES = 256 * 1024;
+
+    ParallelParser(SourceBuffer_sPtr source, ThreadPool& pool, AstArena& arena) {
+        this->source = source;
+        this->pool = &pool;
+        this->arena = &arena;
+    }
+
+    std::vector<AstNode> parse() {
+        uint32_t chunksPerThread = 4;
+        uint32_t targetSize = std::max(MIN_CHUNK_BYTES, source->size() / (uint32_t)(pool->size() * chunksPerThread));
+        std::vector<uint32_t> boundaries = findBoundaries(source->data(), source->size(), targetSize);
+        if (boundaries.size() <= 2) {
+            return parseSerial();
+        }
+
+        std::vector<std::future<Chunk>> chunks;
+        for (size_t i = 0; i + 1 < boundaries.size(); i++) {
+            uint32_t begin = boundaries[i];
+            uint32_t end = boundaries[i + 1];
+            chunks.push_back(pool->submit([this, begin, end] { return parseChunk(begin, end); }));
+        }
+
+        std::vector<AstNode> ast;
+        bool failed = false;
+        for (std::future<Chunk>& future : chunks) {
+            try {
+                Chunk chunk = future.get();
+                if (!failed) {
+                    arena->merge(*chunk.arena);
+                    ast.insert(ast.end(), chunk.statements.begin(), chunk.statements.end());
+                }
+            }
+            catch (...) {
+                failed = true; // Keep waiting so no task outlives this call
+            }
+        }
+
+        if (failed) {
+            return parseSerial();
+        }
+        return ast;
+    }
+
+    // Offsets where the input can be split, always starting with 0 and ending
+    // with length. A split is placed at the first statement boundary after the
+    // current chunk has reached targetSize bytes.
+    static std::vector<uint32_t> findBoundaries(const char* text, uint32_t length, uint32_t targetSize) {
+        std::vector<uint32_t> boundaries;
+        boundaries.push_back(0);
+
+        StatementBoundaryScanner scanner(text, length);
+        uint32_t boundary;
+        while ((boundary = scanner.next()) < length) {
+            if (boundary - boundaries.back() >= targetSize) {
+                boundaries.push_back(boundary);
+            }
+        }
+        boundaries.push_back(length);
+        return boundaries;
+    }
+
+private:
+    Chunk parseChunk(uint32_t begin, uint32_t end) {
+        Chunk chunk;
+        chunk.arena.reset(new AstArena());
+        Lexer lexer(source, begin, end);
+        LexerTokenStream tokens(lexer);
+        Parser parser(tokens, source, *chunk.arena);
+        chunk.statements = parser.parse();
+        return chunk;
+    }
+
+    std::vector<AstNode> parseSerial() {
+        Lexer lexer(source);
+        LexerTokenStream tokens(lexer);
+        Parser parser(tokens, source, *arena);
+        return parser.parse();
+    }
+};
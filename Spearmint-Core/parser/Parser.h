@@ -2,50 +2,83 @@
 
 #include <string>
 #include <vector>
-#include <unordered_set>
+#include <deque>
+#include <memory>
 
 #include "exception/Exception.h"
 #include "lexer/Token.h"
+#include "lexer/SourceBuffer.h"
+#include "lexer/TokenStream.h"
+#include "AstArena.h"
 #include "AstNode.h"
 
 class Parser {
 private:
-    std::vector<Token>* tokens;
-    int index;
+    TokenStream* tokens;
+    std::unique_ptr<TokenStream> ownedTokens;
+    SourceBuffer_sPtr source;
+    AstArena* arena; // Receives every node, the caller keeps it alive as long as the AST
     Token curTok;
-
-    std::vector<AstNode> importStatements;
+    std::deque<Token> lookAheadTokens; // Tokens pulled from the stream but not consumed yet
+    bool reachedEnd = false;
+    uint32_t lastEnd = 0; // End offset of the last consumed token
+    bool lazyFunctions = true;
+    uint32_t scopeDepth = 0; // Blocks around the current statement
 
 public:
-    Parser(std::vector<Token>& tokens) {
+    Parser(TokenStream& tokens, SourceBuffer_sPtr source, AstArena& arena) {
         this->tokens = &tokens;
-        this->index = -1;
+        this->source = source;
+        this->arena = &arena;
+        this->curTok = getNext();
+    }
+
+    Parser(std::vector<Token>& tokens, SourceBuffer_sPtr source, AstArena& arena) {
+        this->ownedTokens.reset(new VectorTokenStream(tokens));
+        this->tokens = ownedTokens.get();
+        this->source = source;
+        this->arena = &arena;
         this->curTok = getNext();
     }
 
 private:
-    bool hasNext(int steps = 1) {
-        return index + steps < (int) tokens->size();
+    // Past the END token the parser only sees null tokens
+    Token pull() {
+        if (reachedEnd) {
+            return Token::getNullToken();
+        }
+        Token tok = tokens->next();
+        reachedEnd = tok.matches(END);
+        return tok;
     }
 
     Token getNext() {
-        if (hasNext()) {
-            index++;
-            curTok = tokens->at(index);
+        lastEnd = curTok.offset + (uint32_t)curTok.value.size();
+        if (!lookAheadTokens.empty()) {
+            curTok = lookAheadTokens.front();
+            lookAheadTokens.pop_front();
         }
         else {
-            curTok = Token::getNullToken();
+            curTok = pull();
         }
         return curTok;
     }
 
     Token lookAhead(int steps = 1) {
-        return hasNext(steps) ? tokens->at((int)(index + steps)) : Token::getNullToken();
+        while ((int)lookAheadTokens.size() < steps) {
+            lookAheadTokens.push_back(pull());
+        }
+        return lookAheadTokens.at(steps - 1);
     }
 
-    void returnToIndex(int i) {
-        index = i-1;
-        getNext();
+    // Record the source range from start up to the last consumed token
+    AstNode finish(AstNodeBase* node, uint32_t start) {
+        node->span = Span(start, lastEnd > start ? lastEnd - start : 0);
+        return AstNode(node);
+    }
+
+    Exception error(std::string message, Token& tok) {
+        return Exception(message, source->getSourceMap(), tok.span());
     }
 
     void skipSemis() {
@@ -55,11 +88,18 @@ private:
     }
 
 public:
+    // Bodies of functions in the global scope are only checked for matching
+    // brackets and compiled when the function is first called. Turn off to
+    // parse them right away.
+    void setLazyFunctions(bool lazyFunctions) {
+        this->lazyFunctions = lazyFunctions;
+    }
+
     // Parse entry point
     std::vector<AstNode> parse() {
         std::vector<AstNode> ast = statements(END);
         if (!curTok.matches(END)) {
-            throw Exception("Did not reach end of input! " + curTok.pos.toString());
+            throw error("Did not reach end of input!", curTok);
         }
         return ast;
     }
@@ -74,7 +114,7 @@ private:
             if (statement_node == nullptr) break;
 
             if (!curTok.matches(SEMICOLON)) {
-                throw Exception("Expected semicolon after statement " + curTok.pos.toString());
+                throw error("Expected semicolon after statement", curTok);
             }
             statements.push_back(statement_node);
             skipSemis();
@@ -83,76 +123,82 @@ private:
         return statements;
     }
 
+    // Statements of a block with a scope of its own
+    std::vector<AstNode> block() {
+        scopeDepth++;
+        std::vector<AstNode> statement_list = statements(RBRACE);
+        scopeDepth--;
+        return statement_list;
+    }
+
     AstNode statement() {
-        while (curTok.matches(KEYWORD, "import")) {
-            importStatement();
+        if (curTok.matches(KEYWORD, KW_IMPORT)) {
+            return importStatement();
         }
-
-        if ((curTok.matches(KEYWORD, "const") || curTok.matches(KEYWORD, "var")) &&
-            lookAhead().matches(ID)) {
+        else if (curTok.matches(KEYWORD, KW_CONST) || (curTok.matches(KEYWORD, KW_VAR) && lookAhead().matches(ID))) {
             return varDeclaration();
         }
-        else if (curTok.matches(ID) && lookAhead().matches(OP, "=")) {
+        else if (curTok.matches(ID) && lookAhead().matches(OP, OP_ASSIGN)) {
             return varAssign();
         }
-        else if (curTok.matches(KEYWORD, "if")) {
+        else if (curTok.matches(KEYWORD, KW_IF)) {
             return ifStatement();
         }
-        else if (curTok.matches(KEYWORD, "for")) {
+        else if (curTok.matches(KEYWORD, KW_FOR)) {
             return forStatement();
         }
-        else if (curTok.matches(KEYWORD, "while")) {
+        else if (curTok.matches(KEYWORD, KW_WHILE)) {
             return whileStatement();
         }
-        else if (curTok.matches(KEYWORD, "break")) {
+        else if (curTok.matches(KEYWORD, KW_BREAK)) {
             return breakStatement();
         }
-        else if (curTok.matches(KEYWORD, "continue")) {
+        else if (curTok.matches(KEYWORD, KW_CONTINUE)) {
             return continueStatement();
         }
-        else if (curTok.matches(KEYWORD, "fn")) {
+        else if (curTok.matches(KEYWORD, KW_FN)) {
             return functionDef();
         }
-        else if (curTok.matches(KEYWORD, "return")) {
+        else if (curTok.matches(KEYWORD, KW_RETURN)) {
             return returnStatement();
         }
-        else if (curTok.matches(KEYWORD, "type")) {
+        else if (curTok.matches(KEYWORD, KW_TYPE)) {
             return structureDef();
         }
 
         return expr(); // Can return nullptr
     }
 
-    void importStatement() {
-        if (!curTok.matches(KEYWORD, "import")) {
-            throw Exception("Expected keyword 'import' " + curTok.pos.toString());
+    AstNode importStatement() {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_IMPORT)) {
+            throw error("Expected keyword 'import'", curTok);
         }
         getNext();
 
         if (!curTok.matches(STRING)) {
-            throw Exception("Expected module name " + curTok.pos.toString());
+            throw error("Expected module name", curTok);
         }
         Token fileNameTok = curTok;
         getNext();
 
-        this->importStatements.push_back(AstNode(new ImportNode(fileNameTok)));
+        return finish(arena->make<ImportNode>(arena->string(fileNameTok.value)), start);
     }
 
-    // Parse a type name
+    // Parse a type name, returns its text or an empty view if there is none
     // id(.id)*(\[\])*
-    AstNode typeExpr() {
-        AstNode typeExprNode = nullptr;
-        int resetIndex = this->index;
-
+    std::string_view typeExpr() {
         if (!curTok.matches(ID)) {
-            returnToIndex(resetIndex);
-            return nullptr;
+            return std::string_view();
         }
+        std::string typeName(curTok.value);
         getNext();
 
         while (curTok.matches(DOT) && lookAhead().matches(ID)) {
             // Access subtype
             getNext();
+            typeName += ".";
+            typeName += curTok.value;
             getNext();
         }
 
@@ -160,60 +206,64 @@ private:
             // Array of type
             getNext();
             getNext();
+            typeName += "[]";
         }
-        return typeExprNode;
+        return arena->string(typeName);
     }
 
     AstNode varDeclaration() {
+        uint32_t start = curTok.offset;
         bool isConstant = false;
         
-        if (curTok.matches(KEYWORD, "const")) {
+        if (curTok.matches(KEYWORD, KW_CONST)) {
             isConstant = true;
             getNext();
         }
 
-        if (!curTok.matches(KEYWORD, "var")) {
-            throw Exception("Expected 'var keyword' " + curTok.pos.toString());
+        if (!curTok.matches(KEYWORD, KW_VAR)) {
+            throw error("Expected 'var keyword'", curTok);
         }
         getNext();
 
         if (!curTok.matches(ID)) {
-            throw Exception("Expected identifier " + curTok.pos.toString());
+            throw error("Expected identifier", curTok);
         }
         Token varNameTok = curTok;
         getNext();
 
         // Optional type declaration
+        std::string_view typeName;
         if (curTok.matches(COLON)) {
             getNext();
 
-            AstNode typeExprNode = typeExpr();
-            if (typeExprNode == nullptr) {
-                throw Exception("Expected type after ':' " + curTok.pos.toString());
+            typeName = typeExpr();
+            if (typeName.empty()) {
+                throw error("Expected type after ':'", curTok);
             }
         }
 
-        if (!curTok.matches(OP, "=")) {
-            throw Exception("Expected '=' " + curTok.pos.toString());
+        if (!curTok.matches(OP, OP_ASSIGN)) {
+            throw error("Expected '='", curTok);
         }
         getNext();
 
         AstNode expr_node = expr();
         if (expr_node == nullptr) {
-            throw Exception("Expected expression " + curTok.pos.toString());
+            throw error("Expected expression", curTok);
         }
 
-        return AstNode(new VarDeclarationNode(varNameTok, expr_node, isConstant));
+        return finish(arena->make<VarDeclarationNode>(arena->string(varNameTok.value), expr_node, isConstant, typeName), start);
     }
 
     AstNode varAssign() {
+        uint32_t start = curTok.offset;
         if (!curTok.matches(ID)) {
             throw Exception("Expected identifier");
         }
         Token varNameTok = curTok;
         getNext();
 
-        if (!curTok.matches(OP, "=")) {
+        if (!curTok.matches(OP, OP_ASSIGN)) {
             throw Exception("Expected '='");
         }
         getNext();
@@ -223,16 +273,17 @@ private:
             throw Exception("Expected expression");
         }
 
-        return AstNode(new VarAssignNode(varNameTok, expr_node));
+        return finish(arena->make<VarAssignNode>(arena->string(varNameTok.value), expr_node), start);
     }
 
     AstNode ifStatement() {
+        uint32_t start = curTok.offset;
         std::vector<AstNode> caseConditions;
-        std::vector<std::vector<AstNode>> caseStatements;
-        std::vector<AstNode> elseCaseStatements;
+        std::vector<NodeList> caseStatements;
+        NodeList elseCaseStatements;
 
         // if
-        if (!curTok.matches(KEYWORD, "if")) {
+        if (!curTok.matches(KEYWORD, KW_IF)) {
             throw Exception("Expected keyword 'if'");
         }
         getNext();
@@ -259,7 +310,7 @@ private:
         }
         getNext();
 
-        caseStatements.push_back(statements(RBRACE));
+        caseStatements.push_back(arena->array(block()));
 
         if (!curTok.matches(RBRACE)) {
             throw Exception("Expected '}'");
@@ -268,7 +319,7 @@ private:
 
 
         // else if
-        while (curTok.matches(KEYWORD, "else") && lookAhead().matches(KEYWORD, "if")) {
+        while (curTok.matches(KEYWORD, KW_ELSE) && lookAhead().matches(KEYWORD, KW_IF)) {
             getNext();
             getNext();
 
@@ -294,7 +345,7 @@ private:
             }
             getNext();
 
-            caseStatements.push_back(statements(RBRACE));
+            caseStatements.push_back(arena->array(block()));
 
             if (!curTok.matches(RBRACE)) {
                 throw Exception("Expected '}'");
@@ -304,7 +355,7 @@ private:
 
 
         // else
-        if (curTok.matches(KEYWORD, "else")) {
+        if (curTok.matches(KEYWORD, KW_ELSE)) {
             getNext();
 
             if (!curTok.matches(LBRACE)) {
@@ -312,7 +363,7 @@ private:
             }
             getNext();
 
-            elseCaseStatements = statements(RBRACE);
+            elseCaseStatements = arena->array(block());
 
             if (!curTok.matches(RBRACE)) {
                 throw Exception("Expected '}'");
@@ -320,11 +371,12 @@ private:
             getNext();
         }
 
-        return AstNode(new IfNode(caseConditions, caseStatements, elseCaseStatements));
+        return finish(arena->make<IfNode>(arena->array(caseConditions), arena->array(caseStatements), elseCaseStatements), start);
     }
 
     AstNode forStatement() {
-        if (!curTok.matches(KEYWORD, "for")) {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_FOR)) {
             throw Exception("Expected keyword 'for'");
         }
         getNext();
@@ -369,18 +421,19 @@ private:
         }
         getNext();
 
-        std::vector<AstNode> statement_list = statements(RBRACE);
+        std::vector<AstNode> statement_list = block();
 
         if (!curTok.matches(RBRACE)) {
             throw Exception("Expected '}'");
         }
         getNext();
 
-        return AstNode(new ForNode(init_statement, cond_node, update_statement, statement_list));
+        return finish(arena->make<ForNode>(init_statement, cond_node, update_statement, arena->array(statement_list)), start);
     }
 
     AstNode whileStatement() {
-        if (!curTok.matches(KEYWORD, "while")) {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_WHILE)) {
             throw Exception("Expected keyword 'while'");
         }
         getNext();
@@ -405,18 +458,19 @@ private:
         }
         getNext();
 
-        std::vector<AstNode> statement_list = statements(RBRACE);
+        std::vector<AstNode> statement_list = block();
 
         if (!curTok.matches(RBRACE)) {
             throw Exception("Expected '}'");
         }
         getNext();
 
-        return AstNode(new WhileNode(cond_node, statement_list));
+        return finish(arena->make<WhileNode>(cond_node, arena->array(statement_list)), start);
     }
 
     AstNode functionDef() {
-        if (!curTok.matches(KEYWORD, "fn")) {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_FN)) {
             throw Exception("Expected keyword 'fun'");
         }
         getNext();
@@ -427,14 +481,14 @@ private:
         Token functionNameTok = curTok;
         getNext();
 
-        std::vector<std::string> argNames;
+        std::vector<std::string_view> argNames;
         if (!curTok.matches(LPAREN)) {
             throw Exception("Expected '('");
         }
         getNext();
 
         if (curTok.matches(ID)) {
-            argNames.push_back(curTok.value);
+            argNames.push_back(arena->string(curTok.value));
             getNext();
 
             while (curTok.matches(COMMA)) {
@@ -443,7 +497,7 @@ private:
                 if (!curTok.matches(ID)) {
                     throw Exception("Expected identifier after ','");
                 }
-                argNames.push_back(curTok.value);
+                argNames.push_back(arena->string(curTok.value));
                 getNext();
             }
         }
@@ -458,46 +512,86 @@ private:
         }
         getNext();
 
-        std::vector<AstNode> statement_list = statements(RBRACE);
+        if (lazyFunctions && scopeDepth == 0) {
+            Span body = skipFunctionBody();
+            getNext();
+            return finish(arena->make<FunctionDefNode>(arena->string(functionNameTok.value), arena->array(argNames), body), start);
+        }
+
+        std::vector<AstNode> statement_list = block();
 
         if (!curTok.matches(RBRACE)) {
             throw Exception("Expected '}'");
         }
         getNext();
 
-        return AstNode(new FunctionDefNode(functionNameTok, argNames, statement_list));
+        return finish(arena->make<FunctionDefNode>(arena->string(functionNameTok.value), arena->array(argNames), arena->array(statement_list)), start);
+    }
+
+    // Pre-parse of a function body: only the tokens are read, and brackets
+    // have to match. Stops at the closing brace and returns the range of the
+    // body, which is parsed for real on the first call.
+    Span skipFunctionBody() {
+        uint32_t begin = curTok.offset;
+        std::vector<TokenType> closing;
+        while (!closing.empty() || !curTok.matches(RBRACE)) {
+            if (curTok.matches(END)) {
+                throw error("Expected '}'", curTok);
+            }
+            else if (curTok.matches(LBRACE)) {
+                closing.push_back(RBRACE);
+            }
+            else if (curTok.matches(LPAREN)) {
+                closing.push_back(RPAREN);
+            }
+            else if (curTok.matches(LBRACKET)) {
+                closing.push_back(RBRACKET);
+            }
+            else if (curTok.matches(RBRACE) || curTok.matches(RPAREN) || curTok.matches(RBRACKET)) {
+                if (closing.empty() || !curTok.matches(closing.back())) {
+                    throw error("Unmatched '" + std::string(curTok.value) + "'", curTok);
+                }
+                closing.pop_back();
+            }
+            getNext();
+        }
+        return Span(begin, curTok.offset - begin);
     }
 
     AstNode returnStatement() {
-        if (!curTok.matches(KEYWORD, "return")) {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_RETURN)) {
             throw Exception("Expected keyword 'return'");
         }
         getNext();
 
         AstNode expr_node = expr();
-        return AstNode(new ReturnNode(expr_node));
+        return finish(arena->make<ReturnNode>(expr_node), start);
     }
 
     AstNode breakStatement() {
-        if (!curTok.matches(KEYWORD, "break")) {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_BREAK)) {
             throw Exception("Expected keyword 'break'");
         }
         getNext();
 
-        return AstNode(new BreakNode());
+        return finish(arena->make<BreakNode>(), start);
     }
 
     AstNode continueStatement() {
-        if (!curTok.matches(KEYWORD, "continue")) {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_CONTINUE)) {
             throw Exception("Expected keyword 'continue'");
         }
         getNext();
 
-        return AstNode(new ContinueNode());
+        return finish(arena->make<ContinueNode>(), start);
     }
 
     AstNode structureDef() {
-        if (!curTok.matches(KEYWORD, "type")) {
+        uint32_t start = curTok.offset;
+        if (!curTok.matches(KEYWORD, KW_TYPE)) {
             throw Exception("Expected keyword 'type'");
         }
         getNext();
@@ -520,40 +614,79 @@ private:
         }
         getNext();
 
-        return AstNode(new StructureDefNode(classNameTok, classStatements));
+        return finish(arena->make<StructureDefNode>(arena->string(classNameTok.value), arena->array(classStatements)), start);
     }
 
     // Expression Parsing
-    AstNode expr() {
-        return comp_expr();
+    // Binary operators are parsed by precedence climbing over this table.
+    // Operators missing from it (0) end the expression.
+    struct BinaryOperator {
+        uint8_t precedence;
+        bool rightAssociative;
+    };
+
+    static const BinaryOperator& binaryOperator(int op) {
+        static const BinaryOperator table[OP_COUNT] = {
+            { 0, false }, // OP_NONE
+            { 3, false }, // OP_ADD
+            { 3, false }, // OP_SUB
+            { 4, false }, // OP_MUL
+            { 4, false }, // OP_DIV
+            { 5, true },  // OP_POW
+            { 4, false }, // OP_MOD
+            { 2, false }, // OP_LT
+            { 2, false }, // OP_GT
+            { 2, false }, // OP_LTE
+            { 2, false }, // OP_GTE
+            { 2, false }, // OP_EE
+            { 2, false }, // OP_NE
+            { 1, false }, // OP_AND
+            { 1, false }, // OP_OR
+            { 0, false }, // OP_NOT
+            { 0, false }, // OP_ASSIGN
+            { 0, false }, // OP_AMPERSAND
+        };
+        return table[op];
     }
 
-    AstNode comp_expr() {
-        return binOp(&Parser::comp_expr2, { "&&", "||" }, &Parser::comp_expr2);
+    AstNode expr() {
+        return binaryExpr(1);
     }
 
-    AstNode comp_expr2() {
-        return binOp(&Parser::arith_expr, { "<", ">", "<=", ">=", "==", "!=" }, &Parser::arith_expr);
-    }
+    // Parse operands joined by operators that bind at least as tightly as minPrecedence
+    AstNode binaryExpr(int minPrecedence) {
+        AstNode left = modifier();
+        if (left == nullptr) {
+            return nullptr;
+        }
 
-    AstNode arith_expr() {
-        return binOp(&Parser::term, { "+", "-" }, &Parser::term);
-    }
+        while (curTok.matches(OP)) {
+            const BinaryOperator& op = binaryOperator(curTok.code);
+            if (op.precedence == 0 || op.precedence < minPrecedence) {
+                break;
+            }
+            Token opTok = curTok;
+            getNext();
 
-    AstNode term() {
-        return binOp(&Parser::power, { "*", "/", "%" }, &Parser::power);
-    }
+            AstNode right = binaryExpr(op.rightAssociative ? op.precedence : op.precedence + 1);
+            if (right == nullptr) {
+                throw Exception("Expected expr after operator");
+            }
+            left = finish(arena->make<BinOpNode>(left, opTok, right), left->span.offset);
+        }
 
-    AstNode power() {
-        return binOp(&Parser::modifier, { "^" }, &Parser::power);
+        return left;
     }
 
     AstNode modifier() {
         AstNode returnNode = atom();
+        if (returnNode == nullptr) {
+            return nullptr;
+        }
 
         // Match function call, attribute access, index access or attribute assignment
         while (curTok.matches(LPAREN) || curTok.matches(DOT) || curTok.matches(LBRACKET) ||
-            curTok.matches(OP, "=")) {
+            curTok.matches(OP, OP_ASSIGN)) {
             returnNode = call(returnNode);
             returnNode = attributeAccess(returnNode);
             //returnNode = indexAccess(returnNode);
@@ -589,7 +722,7 @@ private:
             }
             getNext();
 
-            node = AstNode(new FunctionCallNode(node, argNodes));
+            node = finish(arena->make<FunctionCallNode>(node, arena->array(argNodes)), node->span.offset);
         }
         return node;
     }
@@ -604,7 +737,7 @@ private:
             Token attributeToken = curTok;
             getNext();
 
-            node = AstNode(new AttributeAccessNode(node, attributeToken));
+            node = finish(arena->make<AttributeAccessNode>(node, arena->string(attributeToken.value)), node->span.offset);
         }
         return node;
     }
@@ -630,7 +763,11 @@ private:
     }*/
 
     AstNode attributeAssign(AstNode node) {
-        if (curTok.matches(OP, "=")) {
+        if (curTok.matches(OP, OP_ASSIGN)) {
+            // Variables are assigned by varAssign, anything else but a field cannot be
+            if (node->type != NODE_ATTRIBUTE_ACCESS) {
+                throw Exception("Invalid assignment target", source->getSourceMap(), node->span);
+            }
             getNext();
 
             AstNode valueNode = expr();
@@ -638,13 +775,13 @@ private:
                 throw Exception("Expected value after '='");
             }
 
-            node = AstNode(new AttributeAssignNode(node, valueNode));
+            node = finish(arena->make<AttributeAssignNode>(node, valueNode), node->span.offset);
         }
         return node;
     }
 
     /*AstNode indexAssign(AstNode node) {
-        if (curTok.matches(OP, "=")) {
+        if (curTok.matches(OP, OP_ASSIGN)) {
             getNext();
 
             AstNode valueNode = expr();
@@ -652,48 +789,48 @@ private:
                 throw Exception("Expected value after '='");
             }
 
-            node = AstNode(new AttributeAssignNode(node, valueNode));
+            node = AstNode(arena->make<AttributeAssignNode>(node, valueNode));
         }
         return node;
     }*/
 
     AstNode atom() {
         Token tok = curTok;
-        std::unordered_set<std::string> unaryOps = { "+", "-", "!"};
+        const uint32_t unaryOps = opMask(OP_ADD) | opMask(OP_SUB) | opMask(OP_NOT);
 
-        if (tok.matches(OP, unaryOps)) { // Unary Operation
+        if (tok.matchesAny(OP, unaryOps)) { // Unary Operation
             getNext();
 
             AstNode node = atom();
             if (node == nullptr) {
                 throw Exception("Expected atom after unary operator");
             }
-            return AstNode(new UnaryOpNode(tok, node));
+            return finish(arena->make<UnaryOpNode>(tok, node), tok.offset);
         }
-        else if (curTok.matches(KEYWORD, "new")) { // Contructor Call
+        else if (curTok.matches(KEYWORD, KW_NEW)) { // Contructor Call
             getNext();
 
             AstNode structDefNode = expr();
             if (structDefNode == nullptr) {
                 throw new Exception("Expected constructor call after new keyword");
             }
-            return AstNode(new ConstructorCallNode(structDefNode));
+            return finish(arena->make<ConstructorCallNode>(structDefNode), tok.offset);
         }
         else if (tok.matches(INT)) { // Integer
             getNext();
-            return AstNode(new IntNode(tok));
+            return finish(arena->make<IntNode>(tok), tok.offset);
         }
         else if (tok.matches(FLOAT)) { // Float
             getNext();
-            return AstNode(new FloatNode(tok));
+            return finish(arena->make<FloatNode>(tok), tok.offset);
         }
         else if (tok.matches(STRING)) { // String
             getNext();
-            return AstNode(new StringNode(tok));
+            return finish(arena->make<StringNode>(arena->string(tok.value)), tok.offset);
         }
         else if (tok.matches(ID)) { // Variable Access
             getNext();
-            return AstNode(new VarAccessNode(tok));
+            return finish(arena->make<VarAccessNode>(arena->string(tok.value)), tok.offset);
         }
         else if (tok.matches(LBRACKET)) { // List Creation
             getNext();
@@ -719,7 +856,7 @@ private:
                 throw Exception("Expected ')'");
             }
             getNext();
-            return AstNode(new ListNode(listValueNodes));
+            return finish(arena->make<ListNode>(arena->array(listValueNodes)), tok.offset);
         }
         else if (tok.matches(LPAREN)) { // Parenthesis
             getNext();
@@ -737,22 +874,4 @@ private:
 
         return nullptr;
     }
-
-    typedef AstNode(Parser::* ParserFunction)();
-    AstNode binOp(ParserFunction func1, std::unordered_set<std::string> ops, ParserFunction func2) {
-        AstNode left = ((*this).*func1)();
-
-        while (curTok.matches(OP, ops)) {
-            Token opTok = curTok;
-            getNext();
-
-            AstNode right = ((*this).*func2)();
-            if (right == nullptr) {
-                throw Exception("Expected expr after operator");
-            }
-            left = AstNode(new BinOpNode(left, opTok, right));
-        }
-
-        return left;
-    }
 };
\ No newline at end of file
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <cstring>
+#include <cstdint>
+
+#include "lexer/SourceBuffer.h"
+#include "lexer/MappedFile.h"
+#include "lexer/Token.h"
+#include "AstNode.h"
+#include "FlatAst.h"
+
+// Compiled programs stored next to their source, script.spm -> script.spmc.
+// A cache file is a header followed by the columns of a FlatAst, which are
+// used in place from the mapped file. An entry only counts if it was written
+// by this format version and node layout for a source of the same size and
+// hash, and its payload still matches the hash recorded in the header.
+// Anything else is treated as missing and gets rebuilt.
+class ProgramCache {
+public:
+    // Bump whenever the file layout or the meaning of a FlatAst column changes.
+    // 2: import statements are kept as nodes
+    // 3: function bodies can be stored as source ranges
+    // 4: variables are resolved to slots, column e
+    // 5: loop invariant nodes, loops list their slots in column e
+    // 6: type annotations of variables and typed operations
+    // 7: calls evaluated at compile time
+    // 8: fused nodes
+    // 9: counted for loops
+    static const uint32_t FORMAT_VERSION = 9;
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t formatVersion;
+        uint32_t layout;
+        uint32_t sourceSize;
+        uint64_t sourceHash;
+        uint64_t payloadHash;
+        uint32_t nodeCount;
+        uint32_t listsSize;
+        uint32_t stringCount;
+        uint32_t stringBytes;
+        uint32_t program;
+        uint32_t frameSize;
+    };
+
+    static constexpr char MAGIC[4] = { 'S', 'P', 'M', 'C' };
+
+    // Changes with the node kinds, operator codes and column types
+    static uint32_t layout() {
+        return (uint32_t)NODE_COUNTED_FOR << 24 | (uint32_t)OP_COUNT << 16 | (uint32_t)sizeof(Span) << 8 | (uint32_t)sizeof(int16_t);
+    }
+
+    static size_t align(size_t offset) {
+        return (offset + 7) & ~(size_t)7;
+    }
+
+    // Byte offsets of the sections that follow the header
+    struct Sections {
+        size_t kinds, ops, a, b, c, d, e, spans, lists, stringLengths, stringBytes, end;
+
+        Sections(const Header& header) {
+            size_t n = header.nodeCount;
+            kinds = align(sizeof(Header));
+            ops = align(kinds + n);
+            a = align(ops + n * sizeof(int16_t));
+            b = a + n * sizeof(uint32_t);
+            c = b + n * sizeof(uint32_t);
+            d = c + n * sizeof(uint32_t);
+            e = d + n * sizeof(uint32_t);
+            spans = e + n * sizeof(uint32_t);
+            lists = spans + n * sizeof(Span);
+            stringLengths = lists + (size_t)header.listsSize * sizeof(uint32_t);
+            stringBytes = stringLengths + (size_t)header.stringCount * sizeof(uint32_t);
+            end = stringBytes + header.stringBytes;
+        }
+    };
+
+public:
+    static std::string pathFor(const std::string& sourceFile) {
+        return sourceFile + "c";
+    }
+
+    // Fast non-cryptographic 64 bit hash, only used to notice changed sources
+    // and damaged cache files
+    static uint64_t hash(const char* data, size_t length) {
+        const uint64_t K1 = 0x9E3779B185EBCA87ULL;
+        const uint64_t K2 = 0xC2B2AE3D27D4EB4FULL;
+        uint64_t h = length * K1;
+
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            h ^= word * K2;
+            h = (h << 31 | h >> 33) * K1;
+        }
+        for (; i < length; i++) {
+            h ^= (uint8_t)data[i] * K1;
+            h = (h << 11 | h >> 53) * K2;
+        }
+
+        h ^= h >> 33;
+        h *= K2;
+        h ^= h >> 29;
+        h *= K1;
+        h ^= h >> 32;
+        return h;
+    }
+
+    // Map the cached program for source into program. Returns false if there
+    // is no usable entry.
+    static bool load(const std::string& cacheFile, SourceBuffer_sPtr source, FlatAst& program) {
+        std::unique_ptr<MappedFile> file;
+        try {
+            file = MappedFile::open(cacheFile);
+        }
+        catch (Exception e) {
+            return false;
+        }
+
+        const char* data = file->data();
+        if (file->size() < sizeof(Header)) {
+            return false;
+        }
+        Header header;
+        std::memcpy(&header, data, sizeof(Header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.formatVersion != FORMAT_VERSION ||
+            header.layout != layout() || header.sourceSize != source->size()) {
+            return false;
+        }
+
+        Sections sections(header);
+        if (sections.end != file->size() || header.program >= header.listsSize) {
+            return false;
+        }
+        if (header.sourceHash != hash(source->data(), source->size()) ||
+            header.payloadHash != hash(data + sizeof(Header), file->size() - sizeof(Header))) {
+            return false;
+        }
+
+        std::vector<std::string> strings;
+        strings.reserve(header.stringCount);
+        const char* text = data + sections.stringBytes;
+        uint64_t used = 0;
+        for (uint32_t i = 0; i < header.stringCount; i++) {
+            uint32_t length;
+            std::memcpy(&length, data + sections.stringLengths + i * sizeof(uint32_t), sizeof(length));
+            if (used + length > header.stringBytes) {
+                return false;
+            }
+            strings.emplace_back(text + used, length);
+            used += length;
+        }
+
+        program = FlatAst();
+        program.kinds = (const uint8_t*)(data + sections.kinds);
+        program.ops = (const int16_t*)(data + sections.ops);
+        program.a = (const uint32_t*)(data + sections.a);
+        program.b = (const uint32_t*)(data + sections.b);
+        program.c = (const uint32_t*)(data + sections.c);
+        program.d = (const uint32_t*)(data + sections.d);
+        program.e = (const uint32_t*)(data + sections.e);
+        program.spans = (const Span*)(data + sections.spans);
+        program.lists = (const uint32_t*)(data + sections.lists);
+        program.nodeCount = header.nodeCount;
+        program.listsSize = header.listsSize;
+        program.strings = std::move(strings);
+        program.program = header.program;
+        program.frameSize = header.frameSize;
+        program.source = source;
+        program.setFile(std::move(file));
+        return true;
+    }
+
+    // Write program as the cache entry for source. The cache is only an
+    // optimization, so failures leave the old entry (if any) alone and are
+    // not reported. The file is written under a temporary name of its own and
+    // renamed, so neither a concurrent load nor another writer sees half of it.
+    static void store(const std::string& cacheFile, SourceBuffer& source, const FlatAst& program) {
+        Header header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.formatVersion = FORMAT_VERSION;
+        header.layout = layout();
+        header.sourceSize = source.size();
+        header.sourceHash = hash(source.data(), source.size());
+        header.nodeCount = program.nodeCount;
+        header.listsSize = program.listsSize;
+        header.stringCount = (uint32_t)program.strings.size();
+        header.stringBytes = 0;
+        for (const std::string& str : program.strings) {
+            header.stringBytes += (uint32_t)str.size();
+        }
+        header.program = program.program;
+        header.frameSize = program.frameSize;
+
+        Sections sections(header);
+        std::vector<char> contents(sections.end, 0);
+        size_t n = program.nodeCount;
+        std::memcpy(&contents[sections.kinds], program.kinds, n);
+        std::memcpy(&contents[sections.ops], program.ops, n * sizeof(int16_t));
+        std::memcpy(&contents[sections.a], program.a, n * sizeof(uint32_t));
+        std::memcpy(&contents[sections.b], program.b, n * sizeof(uint32_t));
+        std::memcpy(&contents[sections.c], program.c, n * sizeof(uint32_t));
+        std::memcpy(&contents[sections.d], program.d, n * sizeof(uint32_t));
+        std::memcpy(&contents[sections.e], program.e, n * sizeof(uint32_t));
+        std::memcpy(&contents[sections.spans], program.spans, n * sizeof(Span));
+        std::memcpy(&contents[sections.lists], program.lists, (size_t)program.listsSize * sizeof(uint32_t));
+        size_t offset = sections.stringBytes;
+        for (uint32_t i = 0; i < header.stringCount; i++) {
+            const std::string& str = program.strings[i];
+            uint32_t length = (uint32_t)str.size();
+            std::memcpy(&contents[sections.stringLengths + i * sizeof(uint32_t)], &length, sizeof(length));
+            std::memcpy(&contents[offset], str.data(), length);
+            offset += length;
+        }
+        header.payloadHash = hash(contents.data() + sizeof(Header), contents.size() - sizeof(Header));
+        std::memcpy(contents.data(), &header, sizeof(Header));
+
+        std::string tempFile = cacheFile + "." + std::to_string(std::random_device()()) + ".tmp";
+        {
+            std::ofstream out(tempFile, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                return;
+            }
+            out.write(contents.data(), (std::streamsize)contents.size());
+            if (!out.good()) {
+                out.close();
+                std::error_code ignored;
+                std::filesystem::remove(tempFile, ignored);
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempFile, cacheFile, error);
+        if (error) {
+            std::filesystem::remove(tempFile, error);
+        }
+    }
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+// Finds the offsets right after each ';' that is outside of any bracket,
+// string or comment, i.e. the ends of top-level statements. Strings and
+// comments are recognised the same way the Lexer does, so every boundary is a
+// place where the Lexer would start a new token. Scanning has to start at a
+// boundary (or the beginning of the input).
+class StatementBoundaryScanner {
+private:
+    const char* text;
+    uint32_t length;
+    uint32_t index;
+
+public:
+    StatementBoundaryScanner(const char* text, uint32_t length, uint32_t begin = 0) {
+        this->text = text;
+        this->length = length;
+        this->index = begin;
+    }
+
+    // Next boundary, or length once there is none. Scanning gives up at
+    // unbalanced brackets, unterminated strings and NUL characters, leaving
+    // the rest of the input as a single statement range.
+    uint32_t next() {
+        int depth = 0;
+        uint32_t i = index;
+        while (i < length) {
+            char c = text[i];
+            if (c == '"') {
+                i++;
+                while (i < length && text[i] != '"' && text[i] != '\0') {
+                    i += text[i] == '\\' ? 2 : 1;
+                }
+                if (i >= length || text[i] == '\0') break; // Unterminated, let the Lexer report it
+            }
+            else if (c == '#') {
+                while (i < length && text[i] != '\n') i++;
+                continue;
+            }
+            else if (c == '(' || c == '[' || c == '{') {
+                depth++;
+            }
+            else if (c == ')' || c == ']' || c == '}') {
+                if (--depth < 0) break;
+            }
+            else if (c == ';' && depth == 0) {
+                index = i + 1;
+                return index;
+            }
+            else if (c == '\0') {
+                break; // The Lexer stops here
+            }
+            i++;
+        }
+
+        index = length;
+        return length;
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+
+// Fixed set of worker threads that run submitted tasks in FIFO order. An
+// exception thrown by a task is stored in its future and rethrown by get().
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                available.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    ThreadPool(size_t threadCount) {
+        if (threadCount == 0) threadCount = 1;
+        for (size_t i = 0; i < threadCount; i++) {
+            workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs the tasks that are still queued, then joins the workers
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    size_t size() {
+        return workers.size();
+    }
+
+    template<typename F, typename Result = decltype(std::declval<F&>()())>
+    std::future<Result> submit(F function) {
+        std::shared_ptr<std::packaged_task<Result()>> task(new std::packaged_task<Result()>(std::move(function)));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back([task] { (*task)(); });
+        }
+        available.notify_one();
+        return result;
+    }
+
+    // Process wide pool with one worker per hardware thread
+    static ThreadPool& shared() {
+        static ThreadPool pool(std::thread::hardware_concurrency());
+        return pool;
+    }
+};